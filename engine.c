@@ -3,6 +3,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
 
 #define CHAR_WIDTH 15
 #define CHAR_HEIGHT 18
@@ -16,19 +22,121 @@
 #define DN_SHARE 10
 #define RESO_X 1024
 #define RESO_Y 768
-#define MAP_WIDTH 30
+#define MAP_WIDTH 30       // Size of legacy raw maps and the default map
 #define MAP_HEIGHT 24
 #define VIEW_DEPTH 3
 #define VIEW_WIDTH 9
 #define TARGET_FPS 60
 #define MOVE_DURATION 200    
 #define ROTATE_DURATION 200
-#define FRAME_DELAY (1000 / TARGET_FPS)
+#define CAMERA_SCROLL_DURATION 250 // Top-down camera scroll time in milliseconds
+#define FRAME_PERIOD_NS (1000000000ULL / TARGET_FPS)
 #define M_PI 3.14159265358979323846
 #define ATLAS_COLUMNS 8
 #define TILE_SIZE 32
 #define NUM_TEX 62
 
+// Distance shading
+#define LIGHT_LEVELS 64          // Quantised light levels (0 = black, LIGHT_LEVELS - 1 = full bright)
+#define WALL_LIGHT_FALLOFF 0.1   // Wall shading intensity
+#define FLOOR_LIGHT_FALLOFF 0.2  // Floor shading intensity
+
+// Floor casting
+#define FLOOR_FRAC_BITS 32       // Fractional bits of the fixed-point floor coordinates
+
+// Texture filtering
+#define TEXTURE_MIPMAPS 1        // Sample distant walls and floors from halved copies of their tiles (0 = full size only)
+#define MIP_LEVELS 4             // Tile sizes TILE_SIZE, TILE_SIZE / 2, ... (32, 16, 8 and 4)
+#define TEXTURE_TEXELS (TILE_SIZE * TILE_SIZE * 4 / 3) // Room for a tile and its mip chain
+
+// Camera
+#define FOV_FACTOR 0.66          // Length of the camera plane relative to the direction vector
+
+// Sprites
+#define MAX_SPRITES 256
+
+// Multithreaded raycaster
+#define RENDER_THREADS 0         // Render threads (0 = one per CPU, 1 = single-threaded)
+#define RENDER_BAND_WIDTH 32     // Viewport columns per work item
+#define MAX_RENDER_THREADS 64
+
+// Ray packets
+#define RAY_PACKET 4             // Adjacent columns cast together
+#define RAY_SIMD 1               // Cast packets with SSE2/AVX2 when available (0 = scalar only)
+
+// Fixed-point raycasting
+#define RAY_FIXED 0              // Cast walls and floors in 16.16 fixed point (bit-exact everywhere)
+#define FIXED_SHIFT 16
+#define FIXED_ONE (1 << FIXED_SHIFT)
+#define FIXED_MAX_DELTA ((Sint64)1 << 40) // deltaDist of rays parallel to an axis
+#define TRIG_STEPS 4096          // Angles per turn in the sine table (power of two)
+
+// Map events
+#define EVENT_TYPES 8            // Event types in bits 7-5 of the event byte
+#define EVENT_IDS 32             // Event ids per type in bits 4-0
+#define EVENT_CODE_MAX 65536     // Bytes of compiled event bytecode per map
+#define EVENT_STRINGS_MAX 65536  // Bytes of event message text per map
+#define EVENT_LABELS_MAX 64      // Labels per event script
+#define EVENT_STEP_LIMIT 10000   // Instructions one trigger may run
+#define EVENT_FLAGS 256
+
+// Pathfinding
+#define PATH_NODES_INITIAL 4096  // Node table slots, doubled whenever a search fills half of it
+#define DIST_FIELD_RADIUS 32     // Distance fields cover the cells within this many columns and rows of their target
+#define DIST_FIELD_SIZE (2 * DIST_FIELD_RADIUS + 1)
+#define MAX_DIST_FIELDS 8        // Cached distance fields, the least recently used is replaced
+#define DIST_UNREACHABLE 0xFFFF
+
+// Field of view and automap
+#define FOV_RADIUS 16            // Cells the party can see
+#define FOG_OF_WAR 1             // Top-down view shows only explored cells (0 = whole map)
+
+// Frame pacing
+#define PACE_SPIN_NS 2000000     // Spin this close to the frame deadline instead of sleeping
+#define FRAME_HISTORY 256        // Frames kept for the statistics overlay
+#define FRAME_BUCKET_NS 250000   // Histogram bucket width
+#define FRAME_BUCKETS 200        // Buckets up to 50 ms, longer frames land in the last one
+
+// Dynamic resolution
+#define DYNAMIC_RESOLUTION 1     // Lower the raycaster resolution to hold TARGET_FPS (0 = always full)
+#define FRAME_BUDGET_NS (FRAME_PERIOD_NS * 3 / 4) // Frame work allowed before scaling down
+#define RESOLUTION_COOLDOWN 30   // Frames to wait after a scale change
+#define NUM_RESOLUTION_LEVELS 5
+
+// Compositing
+#define DIRECT_COMPOSITING 1     // Render screen regions straight into the display surface (0 = own surfaces, then blit)
+#define MAX_SCREEN_VIEWS 4
+
+// World chunks
+#define CHUNK_SHIFT 5                       // Chunks are 32x32 cells
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define MAX_RESIDENT_CHUNKS 256             // Chunks kept in memory between frames
+#define CHUNK_PREFETCH_RADIUS 2             // Chunks loaded ahead around the player
+
+// Ray occupancy
+#define SOLID_PAD CHUNK_SIZE                // Solid border around the map, one mask word per chunk row
+#define WALK_PAD CHUNK_SIZE                 // Blocked border left and right of the walk map, likewise
+#define BLOCK_SHIFT 3                       // Open blocks are 8x8 cells
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define BLOCK_MASK (BLOCK_SIZE - 1)
+
+// Asset cache
+#define MAX_ASSETS 64
+#define ASSET_PATH_MAX 256
+#define ASSET_BUDGET (32 * 1024 * 1024)  // Bytes of cached surfaces (0 = no limit)
+
+// Input recording (see --record and --replay)
+#define RECORD_MAGIC "GBRC"
+#define RECORD_VERSION 1
+
+// Benchmark settings
+#define BENCH_FRAMES 600     // Frames rendered per scripted camera path
+#define BENCH_WARMUP 30      // Untimed frames before each path
+#define BENCH_MAZE_SIZE 1024 // Side of the generated maze for the path benchmark
+#define BENCH_MAZE_CORRIDOR 3 // Corridor width of the maze
+#define BENCH_PATH_QUERIES 200
+
 // Tile byte masks
 #define TILE_TYPE_MASK        0xC0 // Bits 7-6
 #define TILE_TYPE_FLOOR       0x00 // 00 in bits 6-7
@@ -50,6 +158,35 @@ typedef enum {
 // Set default display mode
 DisplayMode currentDisplayMode = DISPLAY_MODE_RAYCASTER;
 
+// Screen regions that are redrawn and presented independently
+typedef enum {
+    REGION_VIEWPORT,
+    REGION_COLUMN,
+    REGION_DIALOGUE,
+    NUM_REGIONS
+} ScreenRegion;
+
+// Regions changed since they were last presented
+int regionDirty[NUM_REGIONS] = {1, 1, 1};
+
+// Mark a region for redraw
+void mark_dirty(ScreenRegion region) {
+    regionDirty[region] = 1;
+}
+
+// Mark every region for redraw
+void mark_all_dirty(void) {
+    for (int i = 0; i < NUM_REGIONS; i++) regionDirty[i] = 1;
+}
+
+// Check if any region needs redrawing
+int any_region_dirty(void) {
+    for (int i = 0; i < NUM_REGIONS; i++) {
+        if (regionDirty[i]) return 1;
+    }
+    return 0;
+}
+
 SDL_Surface* tileTextures[NUM_TEX];
 
 // Visual position and direction (for raycaster)
@@ -67,6 +204,10 @@ double targetX, targetY; // Target position for movement animation
 double startAngle;       // Starting angle for rotation animation
 double targetAngle;      // Target angle for rotation animation
 
+// Engine clock in milliseconds, advanced once per frame: real time when playing, recorded time
+// when replaying (see begin_input_frame())
+Uint32 engineTicks = 0;
+
 // Add a time delay between movements (for raycaster)
 Uint32 lastMoveTime = 0; // Timestamp of the last move
 #define MOVE_DELAY 200   // Delay between movements in milliseconds
@@ -81,839 +222,5434 @@ typedef struct {
     uint8_t eventByte;  // Second byte: event type and event ID
 } Cell;
 
-// Create 2D map for game world
-Cell worldMap[MAP_WIDTH][MAP_HEIGHT];
-
-// Get cell type
-uint8_t get_tile_type(Cell cell) {
-    return (cell.tileByte & TILE_TYPE_MASK) >> 6;
-}
+// Map file header, little-endian, followed by its layers
+#define MAP_MAGIC "GBMP"
+#define MAP_VERSION 1
+#define MAP_MAX_LAYERS 4
+#define MAP_LAYER_CELLS 0    // mapWidth * mapHeight Cells, row-major
+#define MAP_LAYER_CEILING 1  // Optional, mapWidth * mapHeight bytes: ceiling texture index + 1, 0 = open
 
-// Get cell texture
-uint8_t get_texture_index(Cell cell) {
-    return cell.tileByte & TEXTURE_INDEX_MASK;
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerOffset[MAP_MAX_LAYERS]; // Byte offset of each layer from the file start (0 = absent)
+} MapHeader;
+
+// Backing store of the world map, row-major, used in place from the mapped file
+Cell* worldMap = NULL;
+int mapWidth = 0;
+int mapHeight = 0;
+void* mapMapping = NULL;  // Whole file mapping, NULL when worldMap is allocated
+size_t mapMappingSize = 0;
+const Uint8* ceilingMap = NULL; // Ceiling layer, used in place from the mapped file, NULL if the map has none
+
+// Resident CHUNK_SIZE x CHUNK_SIZE block of cells. A clean chunk reads the backing store in
+// place, so mapped pages stay shared; the first write gives it a private copy.
+typedef struct {
+    Cell* cells;      // First cell of the chunk, rows stride cells apart
+    int stride;       // mapWidth in the backing store, CHUNK_SIZE in the copy
+    Cell* copy;       // Private CHUNK_SIZE x CHUNK_SIZE cells, NULL until written
+    int index;        // Page table slot
+    Uint32 lastUse;   // Frame the chunk was last near the player
+} Chunk;
+
+// Page table and resident set of the chunk store
+typedef struct {
+    Chunk** table;        // One entry per chunk, NULL when not resident
+    Chunk** resident;     // Resident chunks in load order
+    int numResident;
+    int chunksX;
+    int chunksY;
+    Uint32 frame;         // Use clock, advanced by update_chunks()
+    SDL_mutex* lock;      // Guards loading and eviction
+    SDL_cond* wake;
+    SDL_Thread* prefetcher;
+    int prefetchX;        // Chunk the prefetcher loads around
+    int prefetchY;
+    int prefetchPending;
+    int quit;
+    Uint8* scanned;       // One flag per chunk, set once its walk bits and events are known
+    int* unscannedInRow;  // Chunks of each chunk row not scanned yet
+} ChunkStore;
+
+ChunkStore chunkStore;
+
+// Check if a cell is inside the map
+int in_map(int x, int y) {
+    return x >= 0 && x < mapWidth && y >= 0 && y < mapHeight;
 }
 
-// Get event type
-uint8_t get_event_type(Cell cell) {
-    return (cell.eventByte & EVENT_TYPE_MASK) >> 5;
+// Solid mask of the map for ray casting, one bit per cell, row-major with a solid
+// SOLID_PAD border so rays need no bounds checks. A set bit means "maybe solid" and is
+// confirmed with ray_blocked(); cells of chunks that were never loaded read as solid.
+typedef struct {
+    Uint32* bits;       // One word per chunk row, bit x & 31 for cell x
+    int stride;         // Words per row
+    Uint8* blockOpen;   // One byte per BLOCK_SIZE x BLOCK_SIZE block, 1 = every cell open
+    int blockStride;
+} SolidMap;
+
+SolidMap solidMap;
+
+// Check if a cell may stop a ray (x, y within SOLID_PAD of the map)
+int cell_maybe_solid(int x, int y) {
+    int px = x + SOLID_PAD;
+    return (solidMap.bits[(y + SOLID_PAD) * solidMap.stride + (px >> 5)] >> (px & 31)) & 1;
 }
 
-// Get event id
-uint8_t get_event_id(Cell cell) {
-    return cell.eventByte & EVENT_ID_MASK;
+// Check if every cell in the block holding a cell is open
+int block_open(int x, int y) {
+    return solidMap.blockOpen[((y + SOLID_PAD) >> BLOCK_SHIFT) * solidMap.blockStride + ((x + SOLID_PAD) >> BLOCK_SHIFT)];
 }
 
-// Get size of layout components
-void calculate_layout(int* viewport_width, int* column_width, int* viewport_height, int* column_height, int* dialogue_height) {
-    *viewport_width = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH); 
-    *column_width = RESO_X - *viewport_width;
-    *viewport_height = (RESO_Y * UP_SHARE) / (UP_SHARE + DN_SHARE);
-    *column_height = *viewport_height;
-    *dialogue_height = RESO_Y - *viewport_height;
+// Recompute the open flag of the block holding a cell
+void update_solid_block(int x, int y) {
+    int px = (x + SOLID_PAD) & ~BLOCK_MASK;
+    int py = (y + SOLID_PAD) & ~BLOCK_MASK;
+    Uint32 rows = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        rows |= solidMap.bits[(py + i) * solidMap.stride + (px >> 5)];
+    }
+    int open = ((rows >> (px & 31)) & ((1u << BLOCK_SIZE) - 1)) == 0;
+    __atomic_store_n(&solidMap.blockOpen[(py >> BLOCK_SHIFT) * solidMap.blockStride + (px >> BLOCK_SHIFT)], open, __ATOMIC_RELAXED);
 }
 
-// Get character index in character set
-int get_char_index(const char *c) {
-    const char *char_set = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789.,!?:;[]{}*^-+=<>|~@#$%& ";
-    int index = 0;
-    const char *p = char_set;
-
-    while (*p != '\0') {
-        if ((unsigned char)*p < 0x80) {
-            if (*p == *c) {
-                return index;
-            }
-            p++;
-            index++;
-        } else {
-            if (p[0] == c[0] && p[1] == c[1]) {
-                return index;
+// Rebuild the solid mask of a chunk from its cells (chunk lock held)
+void update_solid_chunk(const Chunk* chunk, int cx, int cy) {
+    int x0 = cx * CHUNK_SIZE;
+    int y0 = cy * CHUNK_SIZE;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        Uint32 word = 0;
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            if (!in_map(x0 + x, y0 + y) || (chunk->cells[y * chunk->stride + x].tileByte & TILE_TYPE_MASK) != TILE_TYPE_FLOOR) {
+                word |= 1u << x;
             }
-            p += 2;
-            index++;
+        }
+        __atomic_store_n(&solidMap.bits[(y0 + y + SOLID_PAD) * solidMap.stride + cx + 1], word, __ATOMIC_RELAXED);
+    }
+    for (int y = 0; y < CHUNK_SIZE; y += BLOCK_SIZE) {
+        for (int x = 0; x < CHUNK_SIZE; x += BLOCK_SIZE) {
+            update_solid_block(x0 + x, y0 + y);
         }
     }
-    return -1;
 }
 
-// Render character using index in grid
-void draw_char(SDL_Surface* surface, SDL_Surface* font_surface, int char_index, int x, int y) {
-    if (char_index != -1) {
-        // Calculate position in the grid
-        int src_x = (char_index % FONT_COLUMNS) * (CHAR_WIDTH + CHAR_SPACING);
-        int src_y = (char_index / FONT_COLUMNS) * (CHAR_HEIGHT + LINE_SPACING);
-
-        // Set source and destination rects
-        SDL_Rect src_rect = { src_x, src_y, CHAR_WIDTH, CHAR_HEIGHT };
-        SDL_Rect dst_rect = { x, y, CHAR_WIDTH, CHAR_HEIGHT };
-
-        // Blit character to surface
-        SDL_BlitSurface(font_surface, &src_rect, surface, &dst_rect);
-    }
+// Allocate the solid mask for the current map, everything solid until loaded
+int solid_map_start(int chunksX, int chunksY) {
+    solidMap.stride = chunksX + 2;
+    solidMap.blockStride = (chunksX + 2) * (CHUNK_SIZE / BLOCK_SIZE);
+    size_t rows = (size_t)(chunksY + 2) * CHUNK_SIZE;
+    solidMap.bits = malloc(rows * solidMap.stride * sizeof(Uint32));
+    solidMap.blockOpen = calloc(rows / BLOCK_SIZE * solidMap.blockStride, 1);
+    if (!solidMap.bits || !solidMap.blockOpen) return 0;
+    memset(solidMap.bits, 0xFF, rows * solidMap.stride * sizeof(Uint32));
+    return 1;
 }
 
-// Render string of text (UTF-8)
-void draw_text(SDL_Surface* surface, SDL_Surface* font_surface, int x, int y, const char* text) {
-    int x_offset = 0;
-    int y_offset = 0;
-    int i = 0;
+// Free the solid mask
+void solid_map_stop(void) {
+    free(solidMap.bits);
+    free(solidMap.blockOpen);
+    memset(&solidMap, 0, sizeof(solidMap));
+}
 
-    while (text[i] != '\0') {
-        if (text[i] == '\n') {
-            y_offset += CHAR_HEIGHT + NLINE_SPACING;
-            x_offset = 0;
-            i++;
-        } else {
-            int char_index;
-            int bytes_advance;
+// Make a chunk resident, reading the backing store in place (lock held)
+Chunk* load_chunk(int cx, int cy) {
+    int index = cy * chunkStore.chunksX + cx;
+    Chunk* chunk = chunkStore.table[index];
+    if (chunk) return chunk;
 
-            unsigned char ch = text[i];
-            if (ch < 0x80) {
-                char_index = get_char_index(&text[i]);
-                bytes_advance = 1;
-            } else if ((ch & 0xE0) == 0xC0) {
-                char_index = get_char_index(&text[i]);
-                bytes_advance = 2;
-            } else {
-                char_index = -1;
-                bytes_advance = 1;
-            }
+    chunk = calloc(1, sizeof(Chunk));
+    if (!chunk) {
+        printf("Unable to allocate map chunk\n");
+        SDL_Quit();
+        exit(1);
+    }
 
-            draw_char(surface, font_surface, char_index, x + x_offset, y + y_offset);
-            x_offset += CHAR_WIDTH + CHAR_SPACING;
+    chunk->cells = &worldMap[(size_t)cy * CHUNK_SIZE * mapWidth + cx * CHUNK_SIZE];
+    chunk->stride = mapWidth;
+    chunk->index = index;
+    chunk->lastUse = chunkStore.frame;
+    update_solid_chunk(chunk, cx, cy);
 
-            i += bytes_advance;
-        }
-    }
+    chunkStore.resident[chunkStore.numResident++] = chunk;
+    __atomic_store_n(&chunkStore.table[index], chunk, __ATOMIC_RELEASE);
+    return chunk;
 }
 
-// Load the map
-int load_map(const char* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        printf("Failed to open map file: %s\n", filename);
-        return 0;
-    }
+// Cells of a chunk that lie on the map
+void chunk_extent(const Chunk* chunk, int* width, int* height) {
+    int x0 = chunk->index % chunkStore.chunksX * CHUNK_SIZE;
+    int y0 = chunk->index / chunkStore.chunksX * CHUNK_SIZE;
+    *width = mapWidth - x0 < CHUNK_SIZE ? mapWidth - x0 : CHUNK_SIZE;
+    *height = mapHeight - y0 < CHUNK_SIZE ? mapHeight - y0 : CHUNK_SIZE;
+}
 
-    for (int y = 0; y < MAP_HEIGHT; y++) {
-        for (int x = 0; x < MAP_WIDTH; x++) {
-            uint8_t bytes[2];
-            if (fread(bytes, 1, 2, file) != 2) {
-                printf("Error reading map data at (%d, %d)\n", x, y);
-                fclose(file);
-                return 0;
-            }
-            worldMap[x][y].tileByte = bytes[0];  // Store the tileByte
-            worldMap[x][y].eventByte = bytes[1]; // Store the eventByte
+// Write a chunk back if needed and drop it (lock held, never while rendering)
+void evict_chunk(int slot) {
+    Chunk* chunk = chunkStore.resident[slot];
+    if (chunk->copy) {
+        Cell* store = &worldMap[(size_t)(chunk->index / chunkStore.chunksX) * CHUNK_SIZE * mapWidth +
+                                (chunk->index % chunkStore.chunksX) * CHUNK_SIZE];
+        int width, height;
+        chunk_extent(chunk, &width, &height);
+        for (int y = 0; y < height; y++) {
+            memcpy(&store[(size_t)y * mapWidth], &chunk->copy[y * CHUNK_SIZE], width * sizeof(Cell));
         }
+        free(chunk->copy);
     }
+    chunkStore.table[chunk->index] = NULL;
+    chunkStore.resident[slot] = chunkStore.resident[--chunkStore.numResident];
+    free(chunk);
+}
 
-    fclose(file);
-    printf("Map loaded successfully from %s\n", filename);
-    return 1;
+// Load a missing chunk on first access
+Chunk* fault_chunk(int cx, int cy) {
+    SDL_LockMutex(chunkStore.lock);
+    Chunk* chunk = load_chunk(cx, cy);
+    SDL_UnlockMutex(chunkStore.lock);
+    return chunk;
 }
 
-// Get texture atlas
-SDL_Surface* texture_atlas = NULL;
-void load_texture_atlas(const char* atlas_filename) {
-    texture_atlas = IMG_Load(atlas_filename);
-    if (!texture_atlas) {
-        printf("Failed to load texture atlas: %s\n", IMG_GetError());
-        SDL_Quit();
-        exit(1);
-    }
+// Get the resident chunk holding a cell
+Chunk* cell_chunk(int x, int y) {
+    Chunk* chunk = __atomic_load_n(&chunkStore.table[(y >> CHUNK_SHIFT) * chunkStore.chunksX + (x >> CHUNK_SHIFT)], __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!chunk, 0)) chunk = fault_chunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    return chunk;
 }
 
-// Get player sprite
-SDL_Surface* playerSprite = NULL;
-void load_player_sprite(const char* spritename) {
-    playerSprite = IMG_Load(spritename);
-    if (!playerSprite) {
-        printf("Failed to load player sprite: %s\n", IMG_GetError());
-        SDL_Quit();
-        exit(1);
+// Get a map cell for writing, copying its chunk out of the backing store on the first write
+// (not while rendering)
+Cell* map_cell(int x, int y) {
+    Chunk* chunk = cell_chunk(x, y);
+    if (!chunk->copy) {
+        Cell* copy = calloc(CHUNK_SIZE * CHUNK_SIZE, sizeof(Cell));
+        if (!copy) {
+            printf("Unable to allocate map chunk\n");
+            SDL_Quit();
+            exit(1);
+        }
+        int width, height;
+        chunk_extent(chunk, &width, &height);
+        for (int row = 0; row < height; row++) {
+            memcpy(&copy[row * CHUNK_SIZE], &chunk->cells[(size_t)row * chunk->stride], width * sizeof(Cell));
+        }
+        chunk->copy = copy;
+        chunk->cells = copy;
+        chunk->stride = CHUNK_SIZE;
     }
+    return &chunk->cells[(y & CHUNK_MASK) * chunk->stride + (x & CHUNK_MASK)];
 }
 
-// Initialize the map
-void initialize_worldMap(const char* filename, const char* atlasname) {
-    if (!load_map(filename)) {
-        printf("Failed to load map. Initializing default map.\n");
-        
-        for (int x = 0; x < MAP_WIDTH; x++) {
-            for (int y = 0; y < MAP_HEIGHT; y++) {
-                if (x == 0 || y == 0 || x == MAP_WIDTH - 1 || y == MAP_HEIGHT - 1) {
-                    worldMap[x][y].tileByte = 1;  // Set tileByte for walls
-                    worldMap[x][y].eventByte = 0; // No event
-                } else {
-                    worldMap[x][y].tileByte = 0;  // Set tileByte for empty space
-                    worldMap[x][y].eventByte = 0; // No event
-                }
-            }
-        }
+// Get a map cell
+Cell get_cell(int x, int y) {
+    const Chunk* chunk = cell_chunk(x, y);
+    return chunk->cells[(size_t)(y & CHUNK_MASK) * chunk->stride + (x & CHUNK_MASK)];
+}
 
-        // Load texture atlas
-        load_texture_atlas(atlasname);
+// Walkable cells of the map, one bit per cell, row-major with a blocked border so searches
+// need no bounds checks: one row above and below, WALK_PAD cells left and right, so every
+// word holds one chunk row. A chunk gets its bits when it is first scanned (see scan_chunk()).
+typedef struct {
+    Uint32* bits;
+    int stride;  // Words per row
+} WalkMap;
 
-        for (int x = 5; x < 19; x++) {
-            worldMap[x][10].tileByte = 1;  // Set tileByte for walls
-            worldMap[x][10].eventByte = 0; // No event
-        }
+WalkMap walkMap;
+
+// Check if a tile can be walked on
+int tile_walkable(Uint8 tileByte) {
+    Uint8 type = tileByte & TILE_TYPE_MASK;
+    return type == TILE_TYPE_FLOOR || type == TILE_TYPE_HALF_FLOOR;
+}
+
+// Set the walk bit of a map cell
+void set_walk_bit(int x, int y, int walkable) {
+    int px = x + WALK_PAD;
+    Uint32* word = &walkMap.bits[(size_t)(y + 1) * walkMap.stride + (px >> 5)];
+    if (walkable) {
+        *word |= 1u << (px & 31);
     } else {
-        load_texture_atlas(atlasname);
+        *word &= ~(1u << (px & 31));
     }
 }
 
-// Get pixel from a surface
-Uint32 get_pixel(SDL_Surface *surface, int x, int y) {
-    if (x < 0 || x >= surface->w || y < 0 || y >= surface->h)
-        return 0; // Out of bounds returns black
+// Free the walk map
+void walk_map_clear(void) {
+    free(walkMap.bits);
+    memset(&walkMap, 0, sizeof(walkMap));
+}
 
-    Uint32 pixel;
-    Uint8 r, g, b;
+// Allocate the walk map for the current map, blocked until chunks are scanned
+int walk_map_start(void) {
+    walk_map_clear();
+    walkMap.stride = (mapWidth + 2 * WALK_PAD + 31) / 32;
+    walkMap.bits = calloc((size_t)(mapHeight + 2) * walkMap.stride, sizeof(Uint32));
+    return walkMap.bits != NULL;
+}
 
-    // Calculate pixel address
-    Uint32 *pixels = (Uint32 *)surface->pixels;
-    pixel = pixels[(y * surface->w) + x];
+// Cells that carry an event, open addressing with linear probing keyed by position
+#define EVENT_KEY_EMPTY 0xFFFFFFFFu
 
-    // Juggling color channels
-    SDL_GetRGB(pixel, surface->format, &b, &g, &r);
-    return SDL_MapRGB(surface->format, r, g, b);
-}
+typedef struct {
+    Uint32* keys;       // y << 16 | x, EVENT_KEY_EMPTY for free slots
+    Uint8* events;      // Event byte of each cell
+    int capacity;       // Power of two
+    int count;
+} EventIndex;
 
-// Put a pixel onto a surface
-void put_pixel(SDL_Surface *surface, int x, int y, Uint32 pixel) {
-    if (x < 0 || x >= surface->w || y < 0 || y >= surface->h)
-        return;
+EventIndex eventIndex;
 
-    Uint32 *pixels = (Uint32 *)surface->pixels;
-    pixels[(y * surface->w) + x] = pixel;
+// Home slot of a key
+int event_slot(Uint32 key) {
+    return (int)((key * 2654435761u) & (Uint32)(eventIndex.capacity - 1));
 }
 
-// Player directions
-typedef enum {
-    NORTH,
-    EAST,
-    SOUTH,
-    WEST
-} Direction;
+// Free the event index
+void event_index_clear(void) {
+    free(eventIndex.keys);
+    free(eventIndex.events);
+    memset(&eventIndex, 0, sizeof(eventIndex));
+}
 
-// Logical position and direction (grid-aligned)
-int gridX = 12;
-int gridY = 12;
-Direction gridDir = NORTH;
+// Resize the table, keeping its entries
+int event_index_resize(int capacity) {
+    EventIndex old = eventIndex;
+    eventIndex.keys = malloc(capacity * sizeof(Uint32));
+    eventIndex.events = malloc(capacity);
+    if (!eventIndex.keys || !eventIndex.events) {
+        free(eventIndex.keys);
+        free(eventIndex.events);
+        eventIndex = old;
+        return 0;
+    }
+    memset(eventIndex.keys, 0xFF, capacity * sizeof(Uint32));
+    eventIndex.capacity = capacity;
+    eventIndex.count = 0;
+
+    for (int i = 0; i < old.capacity; i++) {
+        if (old.keys[i] == EVENT_KEY_EMPTY) continue;
+        int slot = event_slot(old.keys[i]);
+        while (eventIndex.keys[slot] != EVENT_KEY_EMPTY) slot = (slot + 1) & (capacity - 1);
+        eventIndex.keys[slot] = old.keys[i];
+        eventIndex.events[slot] = old.events[i];
+        eventIndex.count++;
+    }
+    free(old.keys);
+    free(old.events);
+    return 1;
+}
 
-// Movement Functions (for raycaster)
-void initiate_move_forward(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        // Determine target grid position
-        int newX = gridX;
-        int newY = gridY;
+// Add, change or (with 0) remove the event of a cell
+void event_index_put(int x, int y, Uint8 eventByte) {
+    Uint32 key = ((Uint32)y << 16) | (Uint32)x;
+    int mask = eventIndex.capacity - 1;
+    int slot = eventIndex.capacity ? event_slot(key) : 0;
 
-        // Move in the direction the player is facing
-        switch (gridDir) {
-            case NORTH: newX += 1; break; // Move up (north)
-            case EAST:  newY -= 1; break; // Move right (east)
-            case SOUTH: newX -= 1; break; // Move down (south)
-            case WEST:  newY += 1; break; // Move left (west)
-        }
+    while (eventIndex.capacity && eventIndex.keys[slot] != EVENT_KEY_EMPTY && eventIndex.keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
 
-        // Check for collision (is walkable?)
-        if (newX >= 0 && newX < MAP_WIDTH && newY >= 0 && newY < MAP_HEIGHT) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileType = get_tile_type(targetCell);
-
-            if (tileType == 0 || tileType == 2) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
+    if (eventByte == 0) {
+        if (!eventIndex.capacity || eventIndex.keys[slot] != key) return;
+
+        // Backward-shift deletion keeps every probe chain unbroken
+        for (int next = (slot + 1) & mask;; next = (next + 1) & mask) {
+            if (eventIndex.keys[next] == EVENT_KEY_EMPTY) break;
+            int home = event_slot(eventIndex.keys[next]);
+            int between = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+            if (between) continue;
+            eventIndex.keys[slot] = eventIndex.keys[next];
+            eventIndex.events[slot] = eventIndex.events[next];
+            slot = next;
         }
+        eventIndex.keys[slot] = EVENT_KEY_EMPTY;
+        eventIndex.count--;
+        return;
     }
-}
 
-void initiate_move_backward(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        int newX = gridX;
-        int newY = gridY;
+    if (eventIndex.capacity && eventIndex.keys[slot] == key) {
+        eventIndex.events[slot] = eventByte;
+        return;
+    }
 
-        switch (gridDir) {
-            case NORTH: newX -= 1; break;
-            case EAST:  newY += 1; break;
-            case SOUTH: newX += 1; break;
-            case WEST:  newY -= 1; break;
+    // Keep the load factor at or below one half
+    if ((eventIndex.count + 1) * 2 > eventIndex.capacity) {
+        if (!event_index_resize(eventIndex.capacity ? eventIndex.capacity * 2 : 64)) {
+            printf("Unable to grow event index\n");
+            return;
         }
+        event_index_put(x, y, eventByte);
+        return;
+    }
+    eventIndex.keys[slot] = key;
+    eventIndex.events[slot] = eventByte;
+    eventIndex.count++;
+}
 
-        // Check for collision (is walkable?)
-        if (newX >= 0 && newX < MAP_WIDTH && newY >= 0 && newY < MAP_HEIGHT) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileType = get_tile_type(targetCell);
-
-            if (tileType == 0 || tileType == 2) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
+// Fill in the walk bits and index the events of a chunk the first time one of its cells is
+// asked about, so loading a map reads none of its cells (main thread)
+void scan_chunk(int cx, int cy) {
+    chunkStore.scanned[cy * chunkStore.chunksX + cx] = 1;
+    chunkStore.unscannedInRow[cy]--;
+    int x0 = cx * CHUNK_SIZE;
+    int y0 = cy * CHUNK_SIZE;
+    const Chunk* chunk = cell_chunk(x0, y0);
+    int width, height;
+    chunk_extent(chunk, &width, &height);
+    for (int y = 0; y < height; y++) {
+        const Cell* row = &chunk->cells[(size_t)y * chunk->stride];
+        Uint32 word = 0;
+        for (int x = 0; x < width; x++) {
+            if (tile_walkable(row[x].tileByte)) word |= 1u << x;
+            if (row[x].eventByte) event_index_put(x0 + x, y0 + y, row[x].eventByte);
         }
+        walkMap.bits[(size_t)(y0 + y + 1) * walkMap.stride + cx + WALK_PAD / 32] = word;
     }
 }
 
-void initiate_turn_left(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        isRotating = 1;
-        rotateStartTime = currentTime;
-        startAngle = dirAngle;
-        gridDir = (gridDir + 1) % 4;
-        targetAngle = startAngle - (M_PI / 2);
+// Scan the chunk holding a map cell unless that happened already
+void scan_chunk_at(int x, int y) {
+    if (__builtin_expect(!chunkStore.scanned[(y >> CHUNK_SHIFT) * chunkStore.chunksX + (x >> CHUNK_SHIFT)], 0)) {
+        scan_chunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
     }
 }
 
-void initiate_turn_right(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        isRotating = 1;
-        rotateStartTime = currentTime;
-        startAngle = dirAngle;
-        gridDir = (gridDir + 3) % 4;
-        targetAngle = startAngle + (M_PI / 2); 
-    }
+// Check the walk bit of a cell whose chunk has been scanned, or of the border
+int scanned_walk_bit(int x, int y) {
+    int px = x + WALK_PAD;
+    return (walkMap.bits[(size_t)(y + 1) * walkMap.stride + (px >> 5)] >> (px & 31)) & 1;
 }
 
-// Movement functions (for topdown view)
-void initiate_move_up(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        int newX = gridX;
-        int newY = gridY - 1; 
+// Check the walk bit of a cell (x, y within one cell of the map)
+int walk_bit(int x, int y) {
+    if (in_map(x, y)) scan_chunk_at(x, y);
+    return scanned_walk_bit(x, y);
+}
 
-        // Check for bounds
-        if (newY >= 0) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileTypeBits = targetCell.tileByte & TILE_TYPE_MASK;
-
-            // Check if tile is walkable
-            if (tileTypeBits == TILE_TYPE_FLOOR || tileTypeBits == TILE_TYPE_HALF_FLOOR) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
-        }
-    }
+// Check if a map cell can be walked on
+int cell_walkable(int x, int y) {
+    return in_map(x, y) && walk_bit(x, y);
 }
 
-void initiate_move_down(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        int newX = gridX;
-        int newY = gridY + 1; 
+// Scan the chunk behind a word of the walk map unless that happened already
+void scan_walk_word(int w, int y) {
+    int cx = w - WALK_PAD / 32;
+    if (cx >= 0 && cx < chunkStore.chunksX && y >= 0 && y < mapHeight) scan_chunk_at(cx * CHUNK_SIZE, y);
+}
 
-        // Check for bounds
-        if (newY >= 0) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileTypeBits = targetCell.tileByte & TILE_TYPE_MASK;
-
-            // Check if tile is walkable 
-            if (tileTypeBits == TILE_TYPE_FLOOR || tileTypeBits == TILE_TYPE_HALF_FLOOR) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
-        }
+// Get the event byte of a cell from the index (0 = no event)
+Uint8 event_at(int x, int y) {
+    if (!in_map(x, y)) return 0;
+    scan_chunk_at(x, y);
+    if (eventIndex.count == 0) return 0;
+    Uint32 key = ((Uint32)y << 16) | (Uint32)x;
+    for (int slot = event_slot(key); eventIndex.keys[slot] != EVENT_KEY_EMPTY; slot = (slot + 1) & (eventIndex.capacity - 1)) {
+        if (eventIndex.keys[slot] == key) return eventIndex.events[slot];
     }
+    return 0;
 }
 
-void initiate_move_right(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        int newX = gridX + 1;
-        int newY = gridY;
+// Cached top-down map layer (see render_top_down()). The surface wraps around in both
+// directions: map tile x, y lives in slot x mod tilesX, y mod tilesY, tagged with the tile it holds.
+typedef struct {
+    SDL_Surface* surface;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    Uint32* tags;   // Map tile in each slot (y << 16 | x)
+    Uint8* drawn;   // 1 when the slot holds the tile of its tag, 0 when it must be drawn
+} TopDownLayer;
+
+TopDownLayer topDownLayer;
+
+// Non-negative remainder
+int wrap_index(int value, int size) {
+    int r = value % size;
+    return r < 0 ? r + size : r;
+}
 
-        // Check for bounds
-        if (newY >= 0) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileTypeBits = targetCell.tileByte & TILE_TYPE_MASK;
-
-            // Check if tile is walkable 
-            if (tileTypeBits == TILE_TYPE_FLOOR || tileTypeBits == TILE_TYPE_HALF_FLOOR) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
-        }
-    }
+// Tag of a map tile, also for tiles off the map
+Uint32 layer_tag(int x, int y) {
+    return ((Uint32)(y & 0xFFFF) << 16) | (Uint32)(x & 0xFFFF);
 }
 
-void initiate_move_left(Uint32 currentTime) {
-    if (!isMoving && !isRotating) {
-        int newX = gridX - 1;
-        int newY = gridY;
+// Slot of a map tile in the layer
+int layer_slot(int x, int y) {
+    return wrap_index(y, topDownLayer.tilesY) * topDownLayer.tilesX + wrap_index(x, topDownLayer.tilesX);
+}
 
-        // Check for bounds
-        if (newY >= 0) {
-            Cell targetCell = worldMap[newX][newY];
-            uint8_t tileTypeBits = targetCell.tileByte & TILE_TYPE_MASK;
-
-            // Check if tile is walkable 
-            if (tileTypeBits == TILE_TYPE_FLOOR || tileTypeBits == TILE_TYPE_HALF_FLOOR) {
-                isMoving = 1;
-                moveStartTime = currentTime;
-                startX = playerX;
-                startY = playerY;
-                targetX = newX + 0.5;
-                targetY = newY + 0.5;
-                gridX = newX;
-                gridY = newY;
-            }
-        }
-    }
+// Redraw a map tile the next time it is shown
+void invalidate_layer_tile(int x, int y) {
+    if (!topDownLayer.tags) return;
+    int slot = layer_slot(x, y);
+    if (topDownLayer.tags[slot] == layer_tag(x, y)) topDownLayer.drawn[slot] = 0;
 }
 
-// Update movement
-void update_movement(Uint32 currentTime) {
-    if (isMoving) {
+// Redraw every tile of the layer
+void invalidate_layer(void) {
+    if (topDownLayer.drawn) memset(topDownLayer.drawn, 0, topDownLayer.tilesX * topDownLayer.tilesY);
+}
+
+// Cells the party has seen, one CHUNK_SIZE x CHUNK_SIZE bit block per chunk (a word per row),
+// allocated the first time a cell of the chunk is seen
+typedef struct {
+    Uint32** blocks;
+    int chunksX;
+    int chunksY;
+    int changed;   // Cells newly seen since the count was last reset
+} ExploredMap;
+
+ExploredMap exploredMap;
+
+// Free the explored cells
+void explored_map_clear(void) {
+    if (exploredMap.blocks) {
+        for (int i = 0; i < exploredMap.chunksX * exploredMap.chunksY; i++) free(exploredMap.blocks[i]);
+    }
+    free(exploredMap.blocks);
+    memset(&exploredMap, 0, sizeof(exploredMap));
+}
+
+// Start with nothing explored on the current map
+int explored_map_start(void) {
+    explored_map_clear();
+    exploredMap.chunksX = (mapWidth + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    exploredMap.chunksY = (mapHeight + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    exploredMap.blocks = calloc(exploredMap.chunksX * exploredMap.chunksY, sizeof(Uint32*));
+    return exploredMap.blocks != NULL;
+}
+
+// Check if a map cell has been seen
+int cell_explored(int x, int y) {
+    const Uint32* block = exploredMap.blocks[(y >> CHUNK_SHIFT) * exploredMap.chunksX + (x >> CHUNK_SHIFT)];
+    return block && ((block[y & CHUNK_MASK] >> (x & CHUNK_MASK)) & 1);
+}
+
+// Mark a cell as seen (ignored outside the map)
+void mark_explored(int x, int y) {
+    if (!in_map(x, y)) return;
+    Uint32** block = &exploredMap.blocks[(y >> CHUNK_SHIFT) * exploredMap.chunksX + (x >> CHUNK_SHIFT)];
+    if (!*block) {
+        *block = calloc(CHUNK_SIZE, sizeof(Uint32));
+        if (!*block) return;
+    }
+
+    Uint32 bit = 1u << (x & CHUNK_MASK);
+    if (!((*block)[y & CHUNK_MASK] & bit)) {
+        (*block)[y & CHUNK_MASK] |= bit;
+        exploredMap.changed++;
+        invalidate_layer_tile(x, y);
+    }
+}
+
+// Jump point search on the 4-connected grid. Of all shortest paths only the canonical one is
+// searched: it moves vertically first and turns from a horizontal into a vertical move only
+// where that is forced, because the cell before the turn has a blocked neighbour on that side.
+// Rows are scanned for forced turns, columns stop wherever a row scan finds something.
+
+// Node of a path search, stored in an open-addressing table keyed by position
+typedef struct {
+    Uint32 key;     // y << 16 | x
+    Uint32 search;  // Search the node belongs to, free slot otherwise
+    Uint32 parent;  // Key of the previous jump point (own key for the start)
+    int g;          // Steps from the start
+    int closed;
+} PathNode;
+
+// Open list entry, ordered by f and then by distance left
+typedef struct {
+    int f;
+    int h;
+    Uint32 key;
+} PathOpen;
+
+typedef struct {
+    PathNode* nodes;
+    int capacity;    // Power of two
+    int count;
+    Uint32 search;   // Current search, slots of older ones count as free
+    PathOpen* open;  // Binary heap
+    int openCount;
+    int openCapacity;
+} PathSearch;
+
+PathSearch pathSearch;
+
+// Cell of a path
+typedef struct {
+    int x;
+    int y;
+} PathStep;
+
+// Home slot of a key, folding the high bits of the product in so rows spread as well as columns
+int path_slot(Uint32 key) {
+    Uint32 hash = key * 2654435761u;
+    return (int)((hash ^ (hash >> 16)) & (Uint32)(pathSearch.capacity - 1));
+}
+
+// Grow the node table, keeping the nodes of the current search
+int path_nodes_resize(int capacity) {
+    PathNode* old = pathSearch.nodes;
+    int oldCapacity = pathSearch.capacity;
+    PathNode* nodes = calloc(capacity, sizeof(PathNode));
+    if (!nodes) return 0;
+
+    pathSearch.nodes = nodes;
+    pathSearch.capacity = capacity;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (old[i].search != pathSearch.search) continue;
+        int slot = path_slot(old[i].key);
+        while (nodes[slot].search == pathSearch.search) slot = (slot + 1) & (capacity - 1);
+        nodes[slot] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+// Find the node of a cell in the current search (NULL if it has none)
+PathNode* path_node_find(Uint32 key) {
+    if (!pathSearch.capacity) return NULL;
+    for (int slot = path_slot(key); pathSearch.nodes[slot].search == pathSearch.search; slot = (slot + 1) & (pathSearch.capacity - 1)) {
+        if (pathSearch.nodes[slot].key == key) return &pathSearch.nodes[slot];
+    }
+    return NULL;
+}
+
+// Add the node of a cell to the current search with g = -1 (NULL if out of memory)
+// Adding may move the table, so earlier node pointers must not be used afterwards
+PathNode* path_node_add(Uint32 key) {
+    if ((pathSearch.count + 1) * 2 > pathSearch.capacity) {
+        if (!path_nodes_resize(pathSearch.capacity ? pathSearch.capacity * 2 : PATH_NODES_INITIAL)) return NULL;
+    }
+
+    int slot = path_slot(key);
+    while (pathSearch.nodes[slot].search == pathSearch.search) slot = (slot + 1) & (pathSearch.capacity - 1);
+
+    PathNode* node = &pathSearch.nodes[slot];
+    node->key = key;
+    node->search = pathSearch.search;
+    node->parent = key;
+    node->g = -1;
+    node->closed = 0;
+    pathSearch.count++;
+    return node;
+}
+
+// Check if open list entry a comes before b
+int path_open_before(const PathOpen* a, const PathOpen* b) {
+    return a->f < b->f || (a->f == b->f && a->h < b->h);
+}
+
+// Add an entry to the open list
+int path_open_push(int f, int h, Uint32 key) {
+    if (pathSearch.openCount == pathSearch.openCapacity) {
+        int capacity = pathSearch.openCapacity ? pathSearch.openCapacity * 2 : PATH_NODES_INITIAL;
+        PathOpen* open = realloc(pathSearch.open, capacity * sizeof(PathOpen));
+        if (!open) return 0;
+        pathSearch.open = open;
+        pathSearch.openCapacity = capacity;
+    }
+
+    PathOpen entry = { f, h, key };
+    int i = pathSearch.openCount++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!path_open_before(&entry, &pathSearch.open[parent])) break;
+        pathSearch.open[i] = pathSearch.open[parent];
+        i = parent;
+    }
+    pathSearch.open[i] = entry;
+    return 1;
+}
+
+// Remove the first entry of the open list
+PathOpen path_open_pop(void) {
+    PathOpen first = pathSearch.open[0];
+    PathOpen last = pathSearch.open[--pathSearch.openCount];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= pathSearch.openCount) break;
+        if (child + 1 < pathSearch.openCount && path_open_before(&pathSearch.open[child + 1], &pathSearch.open[child])) child++;
+        if (!path_open_before(&pathSearch.open[child], &last)) break;
+        pathSearch.open[i] = pathSearch.open[child];
+        i = child;
+    }
+    if (pathSearch.openCount > 0) pathSearch.open[i] = last;
+    return first;
+}
+
+// Scan a row from x, y towards dx until the goal or a forced vertical turn (-1 if blocked first)
+// Works on 32 cells at a time: a turn is forced where a neighbour row has a walkable cell
+// next to a blocked one behind it. The blocked border ends every scan inside the row.
+int jump_horizontal(int x, int y, int dx, int goalX, int goalY) {
+    int stride = walkMap.stride;
+    const Uint32* row = walkMap.bits + (size_t)(y + 1) * stride;
+    const Uint32* up = row - stride;
+    const Uint32* down = row + stride;
+    int first = x + WALK_PAD + dx;           // Padded position of the first cell scanned
+    int goal = y == goalY ? goalX + WALK_PAD : -1;
+
+    // Words are scanned before they are read, unless every chunk of the three rows is
+    int unscanned = 0;
+    for (int ry = y - 1; ry <= y + 1; ry++) {
+        if (ry >= 0 && ry < mapHeight) unscanned += chunkStore.unscannedInRow[ry >> CHUNK_SHIFT];
+    }
+    if (unscanned) {
+        for (int ry = y - 1; ry <= y + 1; ry++) scan_walk_word((first >> 5) - dx, ry);
+    }
+
+    for (int w = first >> 5;; w += dx) {
+        if (unscanned) {
+            for (int ry = y - 1; ry <= y + 1; ry++) scan_walk_word(w, ry);
+        }
+        Uint32 upBehind, downBehind, stop;
+        if (dx > 0) {
+            upBehind = (up[w] << 1) | (w > 0 ? up[w - 1] >> 31 : 0);
+            downBehind = (down[w] << 1) | (w > 0 ? down[w - 1] >> 31 : 0);
+        } else {
+            upBehind = (up[w] >> 1) | (w + 1 < stride ? up[w + 1] << 31 : 0);
+            downBehind = (down[w] >> 1) | (w + 1 < stride ? down[w + 1] << 31 : 0);
+        }
+        stop = ~row[w] | (up[w] & ~upBehind) | (down[w] & ~downBehind);
+        if (goal >= 0 && goal >> 5 == w && (goal - first) * dx >= 0) stop |= 1u << (goal & 31);
+        if (w == first >> 5) stop &= dx > 0 ? ~0u << (first & 31) : ~0u >> (31 - (first & 31));
+        if (!stop) continue;
+
+        int cell = (w << 5) + (dx > 0 ? __builtin_ctz(stop) : 31 - __builtin_clz(stop));
+        return (row[cell >> 5] >> (cell & 31)) & 1 ? cell - WALK_PAD : -1;
+    }
+}
+
+// Scan a column from x, y towards dy until the goal or a row with a jump point (-1 if blocked first)
+// After the first step the cell is scanned: jump_horizontal() on the row before scanned it.
+int jump_vertical(int x, int y, int dy, int goalX, int goalY) {
+    for (int step = 0;; step++) {
+        y += dy;
+        if (!(step ? scanned_walk_bit(x, y) : walk_bit(x, y))) return -1;
+        if (x == goalX && y == goalY) return y;
+        if (jump_horizontal(x, y, 1, goalX, goalY) >= 0 || jump_horizontal(x, y, -1, goalX, goalY) >= 0) return y;
+    }
+}
+
+// Add a jump point reached from another one, if that is shorter than any way found before
+int path_reach(Uint32 fromKey, int fromG, int x, int y, int goalX, int goalY) {
+    int g = fromG + abs(x - (int)(fromKey & 0xFFFF)) + abs(y - (int)(fromKey >> 16));
+    Uint32 key = ((Uint32)y << 16) | (Uint32)x;
+
+    PathNode* node = path_node_find(key);
+    if (!node) node = path_node_add(key);
+    if (!node) return 0;
+    if (node->g >= 0 && node->g <= g) return 1;
+
+    int h = abs(goalX - x) + abs(goalY - y);
+    node->g = g;
+    node->parent = fromKey;
+    node->closed = 0;
+    return path_open_push(g + h, h, key);
+}
+
+// Find a shortest path between two cells with A* over jump points
+// Returns its length in steps (-1 if there is none) and stores its first maxSteps cells after the start
+int find_path(int fromX, int fromY, int goalX, int goalY, PathStep* path, int maxSteps) {
+    if (!cell_walkable(fromX, fromY) || !cell_walkable(goalX, goalY)) return -1;
+    if (fromX == goalX && fromY == goalY) return 0;
+
+    // A new search id frees every node of the previous one
+    if (++pathSearch.search == 0) {
+        memset(pathSearch.nodes, 0, pathSearch.capacity * sizeof(PathNode));
+        pathSearch.search = 1;
+    }
+    pathSearch.count = 0;
+    pathSearch.openCount = 0;
+
+    PathNode* start = path_node_add(((Uint32)fromY << 16) | (Uint32)fromX);
+    if (!start) return -1;
+    start->g = 0;
+    int h = abs(goalX - fromX) + abs(goalY - fromY);
+    if (!path_open_push(h, h, start->key)) return -1;
+
+    Uint32 goalKey = ((Uint32)goalY << 16) | (Uint32)goalX;
+    while (pathSearch.openCount > 0) {
+        PathOpen entry = path_open_pop();
+        PathNode* node = path_node_find(entry.key);
+        if (node->closed || entry.f != node->g + entry.h) continue; // Superseded entry
+        node->closed = 1;
+
+        if (node->key == goalKey) {
+            // Walk back over the jump points, filling in the straight runs between them
+            int length = node->g;
+            while (node->key != node->parent) {
+                int x = node->key & 0xFFFF;
+                int y = node->key >> 16;
+                PathNode* parent = path_node_find(node->parent);
+                int dx = (parent->key & 0xFFFF) > (Uint32)x ? 1 : ((parent->key & 0xFFFF) < (Uint32)x ? -1 : 0);
+                int dy = (parent->key >> 16) > (Uint32)y ? 1 : ((parent->key >> 16) < (Uint32)y ? -1 : 0);
+                for (int g = node->g; g > parent->g; g--, x += dx, y += dy) {
+                    if (g <= maxSteps) {
+                        path[g - 1].x = x;
+                        path[g - 1].y = y;
+                    }
+                }
+                node = parent;
+            }
+            return length;
+        }
+
+        Uint32 key = node->key;
+        Uint32 parentKey = node->parent;
+        int g = node->g;
+        int x = key & 0xFFFF;
+        int y = key >> 16;
+        int px = parentKey & 0xFFFF;
+        int py = parentKey >> 16;
+        int ok = 1;
+
+        if (key == parentKey || x == px) {
+            // The start and nodes reached vertically may go on vertically and turn either way
+            for (int dy = -1; dy <= 1; dy += 2) {
+                if (key != parentKey && dy != (y > py ? 1 : -1)) continue;
+                int jy = jump_vertical(x, y, dy, goalX, goalY);
+                if (jy >= 0) ok &= path_reach(key, g, x, jy, goalX, goalY);
+            }
+            for (int dx = -1; dx <= 1; dx += 2) {
+                int jx = jump_horizontal(x, y, dx, goalX, goalY);
+                if (jx >= 0) ok &= path_reach(key, g, jx, y, goalX, goalY);
+            }
+        } else {
+            // Nodes reached horizontally go on and turn where forced
+            int dx = x > px ? 1 : -1;
+            int jx = jump_horizontal(x, y, dx, goalX, goalY);
+            if (jx >= 0) ok &= path_reach(key, g, jx, y, goalX, goalY);
+            for (int dy = -1; dy <= 1; dy += 2) {
+                if (!walk_bit(x, y + dy) || walk_bit(x - dx, y + dy)) continue;
+                int jy = jump_vertical(x, y, dy, goalX, goalY);
+                if (jy >= 0) ok &= path_reach(key, g, x, jy, goalX, goalY);
+            }
+        }
+        if (!ok) {
+            printf("Out of memory while finding a path\n");
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Distance field: steps to one target from every cell of the window around it, for many
+// walkers heading to the same place. Fields are cached and repaired in place when cells change.
+typedef struct {
+    int valid;
+    int targetX;
+    int targetY;
+    int originX;     // Map position of field cell 0, 0
+    int originY;
+    Uint32 lastUse;
+    Uint16 dist[DIST_FIELD_SIZE * DIST_FIELD_SIZE]; // DIST_UNREACHABLE without a path inside the window
+} DistField;
+
+DistField distFields[MAX_DIST_FIELDS];
+Uint32 distFieldClock = 0;
+
+// Field cells being updated, as dist << 16 | cell
+Uint32 distList[DIST_FIELD_SIZE * DIST_FIELD_SIZE];
+int distQueue[DIST_FIELD_SIZE * DIST_FIELD_SIZE];
+
+const int distStepX[4] = { 0, 1, 0, -1 };
+const int distStepY[4] = { -1, 0, 1, 0 };
+
+// Sort helper for distance lists
+int compare_u32(const void* a, const void* b) {
+    Uint32 x = *(const Uint32*)a;
+    Uint32 y = *(const Uint32*)b;
+    return (x > y) - (x < y);
+}
+
+// Field cell next to another one (-1 outside the window)
+int dist_neighbour(int cell, int direction) {
+    int fx = cell % DIST_FIELD_SIZE + distStepX[direction];
+    int fy = cell / DIST_FIELD_SIZE + distStepY[direction];
+    if (fx < 0 || fy < 0 || fx >= DIST_FIELD_SIZE || fy >= DIST_FIELD_SIZE) return -1;
+    return fy * DIST_FIELD_SIZE + fx;
+}
+
+// Check if the map cell under a field cell can be walked on
+int dist_cell_walkable(const DistField* field, int cell) {
+    return cell_walkable(field->originX + cell % DIST_FIELD_SIZE, field->originY + cell / DIST_FIELD_SIZE);
+}
+
+// Lower distances outwards from seed cells whose distance is already stored
+// Seeds are sorted, merging them with the queue visits cells in order of distance
+void dist_field_propagate(DistField* field, const Uint32* seeds, int numSeeds) {
+    int head = 0;
+    int tail = 0;
+    int next = 0;
+
+    while (next < numSeeds || head < tail) {
+        int cell, d;
+        if (head < tail && (next == numSeeds || field->dist[distQueue[head]] <= (seeds[next] >> 16))) {
+            cell = distQueue[head++];
+            d = field->dist[cell];
+        } else {
+            cell = seeds[next] & 0xFFFF;
+            d = seeds[next++] >> 16;
+            if (field->dist[cell] < d) continue; // Reached from a closer seed meanwhile
+        }
+
+        for (int i = 0; i < 4; i++) {
+            int neighbour = dist_neighbour(cell, i);
+            if (neighbour < 0 || field->dist[neighbour] <= d + 1 || !dist_cell_walkable(field, neighbour)) continue;
+            field->dist[neighbour] = d + 1;
+            distQueue[tail++] = neighbour;
+        }
+    }
+}
+
+// Fill a field with a breadth-first search from its target
+void compute_dist_field(DistField* field, int x, int y) {
+    field->targetX = x;
+    field->targetY = y;
+    field->originX = x - DIST_FIELD_RADIUS;
+    field->originY = y - DIST_FIELD_RADIUS;
+    memset(field->dist, 0xFF, sizeof(field->dist));
+
+    Uint32 target = DIST_FIELD_RADIUS * DIST_FIELD_SIZE + DIST_FIELD_RADIUS;
+    field->dist[target] = 0;
+    dist_field_propagate(field, &target, 1);
+    field->valid = 1;
+}
+
+// Shortest distance to a field cell over its neighbours (DIST_UNREACHABLE if none is reachable)
+int dist_from_neighbours(const DistField* field, int cell) {
+    int best = DIST_UNREACHABLE;
+    for (int i = 0; i < 4; i++) {
+        int neighbour = dist_neighbour(cell, i);
+        if (neighbour >= 0 && field->dist[neighbour] < DIST_UNREACHABLE && field->dist[neighbour] + 1 < best) {
+            best = field->dist[neighbour] + 1;
+        }
+    }
+    return best;
+}
+
+// Repair a field after a cell became walkable: distances can only drop
+void dist_field_open(DistField* field, int cell) {
+    int d = dist_from_neighbours(field, cell);
+    if (d >= field->dist[cell]) return;
+    field->dist[cell] = d;
+    distList[0] = ((Uint32)d << 16) | (Uint32)cell;
+    dist_field_propagate(field, distList, 1);
+}
+
+// Repair a field after a cell became blocked. Cells whose every shortest path led through it
+// are cleared in order of distance, then refilled from the cells around them.
+void dist_field_block(DistField* field, int cell) {
+    if (field->dist[cell] == DIST_UNREACHABLE) return;
+
+    int count = 0;
+    distList[count++] = ((Uint32)field->dist[cell] << 16) | (Uint32)cell;
+    field->dist[cell] = DIST_UNREACHABLE;
+
+    for (int head = 0; head < count; head++) {
+        int u = distList[head] & 0xFFFF;
+        int d = (distList[head] >> 16) + 1;
+        for (int i = 0; i < 4; i++) {
+            int v = dist_neighbour(u, i);
+            if (v < 0 || field->dist[v] != d) continue;
+
+            // Keep cells that still have a neighbour one step closer
+            int supported = 0;
+            for (int j = 0; j < 4 && !supported; j++) {
+                int w = dist_neighbour(v, j);
+                supported = w >= 0 && field->dist[w] == d - 1;
+            }
+            if (supported) continue;
+
+            distList[count++] = ((Uint32)d << 16) | (Uint32)v;
+            field->dist[v] = DIST_UNREACHABLE;
+        }
+    }
+
+    // Seed the cleared cells from the rest of the field, in place
+    int numSeeds = 0;
+    for (int i = 0; i < count; i++) {
+        int v = distList[i] & 0xFFFF;
+        if (!dist_cell_walkable(field, v)) continue;
+        int d = dist_from_neighbours(field, v);
+        if (d == DIST_UNREACHABLE) continue;
+        field->dist[v] = d;
+        distList[numSeeds++] = ((Uint32)d << 16) | (Uint32)v;
+    }
+    qsort(distList, numSeeds, sizeof(Uint32), compare_u32);
+    dist_field_propagate(field, distList, numSeeds);
+}
+
+// Repair the cached fields around a cell whose walkability changed
+void update_dist_fields(int x, int y) {
+    for (int i = 0; i < MAX_DIST_FIELDS; i++) {
+        DistField* field = &distFields[i];
+        int fx = x - field->originX;
+        int fy = y - field->originY;
+        if (!field->valid || fx < 0 || fy < 0 || fx >= DIST_FIELD_SIZE || fy >= DIST_FIELD_SIZE) continue;
+        if (x == field->targetX && y == field->targetY) continue; // The target keeps distance 0
+
+        if (walk_bit(x, y)) {
+            dist_field_open(field, fy * DIST_FIELD_SIZE + fx);
+        } else {
+            dist_field_block(field, fy * DIST_FIELD_SIZE + fx);
+        }
+    }
+}
+
+// Drop every cached field
+void dist_fields_clear(void) {
+    for (int i = 0; i < MAX_DIST_FIELDS; i++) distFields[i].valid = 0;
+}
+
+// Get the distance field toward a cell, computed unless it is cached
+// The field stays valid until MAX_DIST_FIELDS other targets have been requested since
+const DistField* acquire_dist_field(int x, int y) {
+    DistField* victim = &distFields[0];
+    distFieldClock++;
+
+    for (int i = 0; i < MAX_DIST_FIELDS; i++) {
+        DistField* field = &distFields[i];
+        if (field->valid && field->targetX == x && field->targetY == y) {
+            field->lastUse = distFieldClock;
+            return field;
+        }
+        if (victim->valid && (!field->valid || field->lastUse < victim->lastUse)) victim = field;
+    }
+
+    compute_dist_field(victim, x, y);
+    victim->lastUse = distFieldClock;
+    return victim;
+}
+
+// Get the steps from a cell to the target of a field (DIST_UNREACHABLE outside the window)
+int dist_field_get(const DistField* field, int x, int y) {
+    int fx = x - field->originX;
+    int fy = y - field->originY;
+    if (fx < 0 || fy < 0 || fx >= DIST_FIELD_SIZE || fy >= DIST_FIELD_SIZE) return DIST_UNREACHABLE;
+    return field->dist[fy * DIST_FIELD_SIZE + fx];
+}
+
+// Get the next cell from x, y toward the target of a field
+// Returns 0 at the target or when it cannot be reached from x, y
+int dist_field_step(const DistField* field, int x, int y, int* nextX, int* nextY) {
+    int d = dist_field_get(field, x, y);
+    if (d == 0 || d == DIST_UNREACHABLE) return 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (dist_field_get(field, x + distStepX[i], y + distStepY[i]) == d - 1) {
+            *nextX = x + distStepX[i];
+            *nextY = y + distStepY[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Change a map cell and keep the solid mask, walk map, distance fields, event index and
+// top-down layer in step (not while rendering)
+void set_cell(int x, int y, Cell cell) {
+    scan_chunk_at(x, y);
+    Cell* target = map_cell(x, y);
+    if (target->eventByte != cell.eventByte) event_index_put(x, y, cell.eventByte);
+    int walkable = tile_walkable(cell.tileByte);
+    if (walkable != tile_walkable(target->tileByte)) {
+        set_walk_bit(x, y, walkable);
+        update_dist_fields(x, y);
+    }
+    if (target->tileByte != cell.tileByte) invalidate_layer_tile(x, y);
+    *target = cell;
+    int px = x + SOLID_PAD;
+    Uint32* word = &solidMap.bits[(y + SOLID_PAD) * solidMap.stride + (px >> 5)];
+    if ((cell.tileByte & TILE_TYPE_MASK) != TILE_TYPE_FLOOR) {
+        *word |= 1u << (px & 31);
+    } else {
+        *word &= ~(1u << (px & 31));
+    }
+    update_solid_block(x, y);
+}
+
+// Load the chunks within CHUNK_PREFETCH_RADIUS of the requested chunk in the background
+int chunk_prefetcher(void* data) {
+    (void)data;
+    SDL_LockMutex(chunkStore.lock);
+    while (!chunkStore.quit) {
+        if (!chunkStore.prefetchPending) {
+            SDL_CondWait(chunkStore.wake, chunkStore.lock);
+            continue;
+        }
+        chunkStore.prefetchPending = 0;
+        int centerX = chunkStore.prefetchX;
+        int centerY = chunkStore.prefetchY;
+
+        for (int cy = centerY - CHUNK_PREFETCH_RADIUS; cy <= centerY + CHUNK_PREFETCH_RADIUS; cy++) {
+            for (int cx = centerX - CHUNK_PREFETCH_RADIUS; cx <= centerX + CHUNK_PREFETCH_RADIUS; cx++) {
+                if (cx < 0 || cy < 0 || cx >= chunkStore.chunksX || cy >= chunkStore.chunksY) continue;
+                if (chunkStore.table[cy * chunkStore.chunksX + cx]) continue;
+                load_chunk(cx, cy);
+
+                // Let renderers fault chunks in between prefetches
+                SDL_UnlockMutex(chunkStore.lock);
+                SDL_LockMutex(chunkStore.lock);
+                if (chunkStore.quit || chunkStore.prefetchPending) break;
+            }
+            if (chunkStore.quit || chunkStore.prefetchPending) break;
+        }
+    }
+    SDL_UnlockMutex(chunkStore.lock);
+    return 0;
+}
+
+// Set up the chunk store for the current map, prefetching only when it does not fit in memory
+int chunk_store_start(void) {
+    memset(&chunkStore, 0, sizeof(chunkStore));
+    chunkStore.chunksX = (mapWidth + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    chunkStore.chunksY = (mapHeight + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int numChunks = chunkStore.chunksX * chunkStore.chunksY;
+
+    chunkStore.table = calloc(numChunks, sizeof(Chunk*));
+    chunkStore.resident = calloc(numChunks, sizeof(Chunk*));
+    chunkStore.scanned = calloc(numChunks, 1);
+    chunkStore.unscannedInRow = malloc(chunkStore.chunksY * sizeof(int));
+    if (!chunkStore.unscannedInRow) return 0;
+    for (int i = 0; i < chunkStore.chunksY; i++) chunkStore.unscannedInRow[i] = chunkStore.chunksX;
+    chunkStore.lock = SDL_CreateMutex();
+    if (!chunkStore.table || !chunkStore.resident || !chunkStore.scanned || !chunkStore.lock) return 0;
+    if (!solid_map_start(chunkStore.chunksX, chunkStore.chunksY)) return 0;
+
+    if (numChunks > MAX_RESIDENT_CHUNKS) {
+        chunkStore.wake = SDL_CreateCond();
+        chunkStore.prefetcher = chunkStore.wake ? SDL_CreateThread(chunk_prefetcher, NULL) : NULL;
+        if (!chunkStore.prefetcher) {
+            printf("Unable to start chunk prefetcher: %s\n", SDL_GetError());
+        }
+    }
+    return 1;
+}
+
+// Stop the prefetcher, write back changed chunks and free the chunk store
+void chunk_store_stop(void) {
+    if (chunkStore.prefetcher) {
+        SDL_LockMutex(chunkStore.lock);
+        chunkStore.quit = 1;
+        SDL_CondSignal(chunkStore.wake);
+        SDL_UnlockMutex(chunkStore.lock);
+        SDL_WaitThread(chunkStore.prefetcher, NULL);
+    }
+    while (chunkStore.numResident > 0) evict_chunk(chunkStore.numResident - 1);
+    if (chunkStore.wake) SDL_DestroyCond(chunkStore.wake);
+    if (chunkStore.lock) SDL_DestroyMutex(chunkStore.lock);
+    free(chunkStore.table);
+    free(chunkStore.resident);
+    free(chunkStore.scanned);
+    free(chunkStore.unscannedInRow);
+    memset(&chunkStore, 0, sizeof(chunkStore));
+    solid_map_stop();
+}
+
+// Keep the chunks around a cell, prefetch its neighbours and evict the least recently used
+// Call once per frame from the main thread, never while rendering
+void update_chunks(int x, int y) {
+    if (!chunkStore.table) return;
+    int centerX = x >> CHUNK_SHIFT;
+    int centerY = y >> CHUNK_SHIFT;
+
+    SDL_LockMutex(chunkStore.lock);
+    Uint32 frame = ++chunkStore.frame;
+
+    // Chunks near the player count as used
+    for (int cy = centerY - CHUNK_PREFETCH_RADIUS; cy <= centerY + CHUNK_PREFETCH_RADIUS; cy++) {
+        for (int cx = centerX - CHUNK_PREFETCH_RADIUS; cx <= centerX + CHUNK_PREFETCH_RADIUS; cx++) {
+            if (cx < 0 || cy < 0 || cx >= chunkStore.chunksX || cy >= chunkStore.chunksY) continue;
+            Chunk* chunk = chunkStore.table[cy * chunkStore.chunksX + cx];
+            if (chunk) chunk->lastUse = frame;
+        }
+    }
+
+    // Evict least recently used chunks over the budget
+    while (chunkStore.numResident > MAX_RESIDENT_CHUNKS) {
+        int victim = 0;
+        for (int i = 1; i < chunkStore.numResident; i++) {
+            if (chunkStore.resident[i]->lastUse < chunkStore.resident[victim]->lastUse) victim = i;
+        }
+        if (chunkStore.resident[victim]->lastUse == frame) break;
+        evict_chunk(victim);
+    }
+
+    // Wake the prefetcher when the player enters another chunk
+    if (chunkStore.prefetcher && (centerX != chunkStore.prefetchX || centerY != chunkStore.prefetchY || frame == 1)) {
+        chunkStore.prefetchX = centerX;
+        chunkStore.prefetchY = centerY;
+        chunkStore.prefetchPending = 1;
+        SDL_CondSignal(chunkStore.wake);
+    }
+    SDL_UnlockMutex(chunkStore.lock);
+}
+
+// Get cell type
+uint8_t get_tile_type(Cell cell) {
+    return (cell.tileByte & TILE_TYPE_MASK) >> 6;
+}
+
+// Get cell texture
+uint8_t get_texture_index(Cell cell) {
+    return cell.tileByte & TEXTURE_INDEX_MASK;
+}
+
+// Get event type
+uint8_t get_event_type(Cell cell) {
+    return (cell.eventByte & EVENT_TYPE_MASK) >> 5;
+}
+
+// Get event id
+uint8_t get_event_id(Cell cell) {
+    return cell.eventByte & EVENT_ID_MASK;
+}
+
+// Get monotonic time in nanoseconds
+Uint64 get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + (Uint64)ts.tv_nsec;
+}
+
+// Render phases timed by the benchmark
+typedef enum {
+    PHASE_DDA,
+    PHASE_FLOOR,
+    PHASE_WALL,
+    PHASE_SPRITE,
+    PHASE_BLIT,
+    NUM_PHASES
+} RenderPhase;
+
+#ifdef BENCH
+// Accumulated time per phase (nanoseconds), summed over all render threads
+Uint64 phaseTime[NUM_PHASES];
+
+// Phase time of the current thread not yet added to phaseTime
+__thread Uint64 threadPhaseTime[NUM_PHASES];
+
+// Add this thread's phase time to the totals
+void phase_flush(void) {
+    for (int p = 0; p < NUM_PHASES; p++) {
+        __atomic_fetch_add(&phaseTime[p], threadPhaseTime[p], __ATOMIC_RELAXED);
+        threadPhaseTime[p] = 0;
+    }
+}
+
+// Start a phase timer, then charge elapsed time to a phase and restart it
+#define PHASE_START(t) Uint64 t = get_time_ns()
+#define PHASE_MARK(t, phase) do { Uint64 now_ = get_time_ns(); threadPhaseTime[phase] += now_ - (t); (t) = now_; } while (0)
+#define PHASE_RESTART(t) ((t) = get_time_ns())
+#define PHASE_FLUSH() phase_flush()
+#else
+#define PHASE_START(t)
+#define PHASE_MARK(t, phase)
+#define PHASE_RESTART(t)
+#define PHASE_FLUSH()
+#endif
+
+#ifdef OVERDRAW
+// Writes per pixel of the last raycaster frame (build with -DOVERDRAW). Bands write disjoint
+// columns, so the render threads need no locking.
+typedef struct {
+    Uint16* counts;
+    int width;
+    int height;
+    int capacity;
+} OverdrawMap;
+
+OverdrawMap overdraw;
+int showOverdraw = 0;
+
+// Reset the counters for a frame
+void overdraw_begin(int width, int height) {
+    if (width * height > overdraw.capacity) {
+        Uint16* counts = realloc(overdraw.counts, width * height * sizeof(Uint16));
+        if (!counts) return;
+        overdraw.counts = counts;
+        overdraw.capacity = width * height;
+    }
+    overdraw.width = width;
+    overdraw.height = height;
+    memset(overdraw.counts, 0, width * height * sizeof(Uint16));
+}
+
+// Count the pixels never written and written more than once, and all writes
+void overdraw_summary(int* unwritten, int* overdrawn, Uint64* writes) {
+    *unwritten = 0;
+    *overdrawn = 0;
+    *writes = 0;
+    for (int i = 0; i < overdraw.width * overdraw.height; i++) {
+        if (overdraw.counts[i] == 0) (*unwritten)++;
+        if (overdraw.counts[i] > 1) (*overdrawn)++;
+        *writes += overdraw.counts[i];
+    }
+}
+
+// Paint the counts over a surface: unwritten magenta, once dark grey, then yellow, orange, red
+void draw_overdraw_map(SDL_Surface* surface) {
+    Uint32 colors[5] = {
+        SDL_MapRGB(surface->format, 255, 0, 255), SDL_MapRGB(surface->format, 40, 40, 40),
+        SDL_MapRGB(surface->format, 255, 255, 0), SDL_MapRGB(surface->format, 255, 128, 0),
+        SDL_MapRGB(surface->format, 255, 0, 0)
+    };
+    if (overdraw.width == 0 || SDL_LockSurface(surface) < 0) return;
+    for (int y = 0; y < surface->h; y++) {
+        Uint32* row = (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+        const Uint16* counts = overdraw.counts + (y * overdraw.height / surface->h) * overdraw.width;
+        for (int x = 0; x < surface->w; x++) {
+            int count = counts[x * overdraw.width / surface->w];
+            row[x] = colors[count < 4 ? count : 4];
+        }
+    }
+    SDL_UnlockSurface(surface);
+}
+
+#define OVERDRAW_BEGIN(width, height) overdraw_begin(width, height)
+#define OVERDRAW_COUNT(x, y) (overdraw.counts[(y) * overdraw.width + (x)]++)
+#else
+#define OVERDRAW_BEGIN(width, height)
+#define OVERDRAW_COUNT(x, y)
+#endif
+
+// Get size of layout components
+void calculate_layout(int* viewport_width, int* column_width, int* viewport_height, int* column_height, int* dialogue_height) {
+    *viewport_width = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH); 
+    *column_width = RESO_X - *viewport_width;
+    *viewport_height = (RESO_Y * UP_SHARE) / (UP_SHARE + DN_SHARE);
+    *column_height = *viewport_height;
+    *dialogue_height = RESO_Y - *viewport_height;
+}
+
+// Characters in the font image, in grid order (UTF-8)
+const char* fontCharSet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789.,!?:;[]{}*^-+=<>|~@#$%& ";
+
+// Codepoint to glyph index, covers ASCII and 2-byte UTF-8
+#define GLYPH_TABLE_SIZE 0x800
+Sint16 glyphTable[GLYPH_TABLE_SIZE];
+int glyphTableValid = 0;
+
+// Decode one ASCII or 2-byte UTF-8 character, returns -1 for anything else
+int decode_utf8(const char* text, int* bytes_advance) {
+    unsigned char c0 = text[0];
+    if (c0 < 0x80) {
+        *bytes_advance = 1;
+        return c0;
+    }
+    unsigned char c1 = text[1];
+    if ((c0 & 0xE0) == 0xC0 && (c1 & 0xC0) == 0x80) {
+        *bytes_advance = 2;
+        return ((c0 & 0x1F) << 6) | (c1 & 0x3F);
+    }
+    *bytes_advance = 1;
+    return -1;
+}
+
+// Build the glyph table from the font character set
+void build_glyph_table(void) {
+    for (int i = 0; i < GLYPH_TABLE_SIZE; i++) glyphTable[i] = -1;
+
+    int index = 0;
+    const char* p = fontCharSet;
+    while (*p != '\0') {
+        int bytes_advance;
+        int codepoint = decode_utf8(p, &bytes_advance);
+        if (codepoint >= 0 && glyphTable[codepoint] < 0) glyphTable[codepoint] = index;
+        p += bytes_advance;
+        index++;
+    }
+    glyphTableValid = 1;
+}
+
+// Get glyph index of the character at text and its length in bytes
+int get_char_index_advance(const char* text, int* bytes_advance) {
+    int codepoint = decode_utf8(text, bytes_advance);
+    if (!glyphTableValid) build_glyph_table();
+    return codepoint < 0 ? -1 : glyphTable[codepoint];
+}
+
+// Get character index in character set
+int get_char_index(const char *c) {
+    int bytes_advance;
+    return get_char_index_advance(c, &bytes_advance);
+}
+
+// Render character using index in grid
+void draw_char(SDL_Surface* surface, SDL_Surface* font_surface, int char_index, int x, int y) {
+    if (char_index != -1) {
+        // Calculate position in the grid
+        int src_x = (char_index % FONT_COLUMNS) * (CHAR_WIDTH + CHAR_SPACING);
+        int src_y = (char_index / FONT_COLUMNS) * (CHAR_HEIGHT + LINE_SPACING);
+
+        // Set source and destination rects
+        SDL_Rect src_rect = { src_x, src_y, CHAR_WIDTH, CHAR_HEIGHT };
+        SDL_Rect dst_rect = { x, y, CHAR_WIDTH, CHAR_HEIGHT };
+
+        // Blit character to surface
+        SDL_BlitSurface(font_surface, &src_rect, surface, &dst_rect);
+    }
+}
+
+// Render string of text (UTF-8)
+void draw_text(SDL_Surface* surface, SDL_Surface* font_surface, int x, int y, const char* text) {
+    int x_offset = 0;
+    int y_offset = 0;
+    int i = 0;
+
+    while (text[i] != '\0') {
+        if (text[i] == '\n') {
+            y_offset += CHAR_HEIGHT + NLINE_SPACING;
+            x_offset = 0;
+            i++;
+        } else {
+            int bytes_advance;
+            int char_index = get_char_index_advance(&text[i], &bytes_advance);
+
+            draw_char(surface, font_surface, char_index, x + x_offset, y + y_offset);
+            x_offset += CHAR_WIDTH + CHAR_SPACING;
+
+            i += bytes_advance;
+        }
+    }
+}
+
+// Longest text a panel can hold
+#define PANEL_TEXT_MAX 1024
+
+// Text panel rasterised into its own surface, redrawn only when its text changes
+typedef struct {
+    SDL_Surface* surface;
+    Uint32 background;
+    ScreenRegion region;
+    int valid;
+    char text[PANEL_TEXT_MAX];
+} TextPanel;
+
+// Create a panel surface in the screen format
+int create_text_panel(TextPanel* panel, SDL_Surface* screen, int width, int height, Uint8 r, Uint8 g, Uint8 b, ScreenRegion region) {
+    SDL_PixelFormat* fmt = screen->format;
+    panel->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0);
+    if (!panel->surface) return 0;
+    panel->background = SDL_MapRGB(panel->surface->format, r, g, b);
+    panel->region = region;
+    panel->valid = 0;
+    panel->text[0] = '\0';
+    return 1;
+}
+
+// Change the text of a panel, returns 1 if it changed
+int set_panel_text(TextPanel* panel, const char* text) {
+    if (panel->valid && strncmp(panel->text, text, PANEL_TEXT_MAX - 1) == 0) return 0;
+    strncpy(panel->text, text, PANEL_TEXT_MAX - 1);
+    panel->text[PANEL_TEXT_MAX - 1] = '\0';
+    panel->valid = 0;
+    mark_dirty(panel->region);
+    return 1;
+}
+
+// Get the panel surface, rasterising the text if it changed
+SDL_Surface* render_text_panel(TextPanel* panel, SDL_Surface* font_surface) {
+    if (!panel->valid) {
+        SDL_FillRect(panel->surface, NULL, panel->background);
+        draw_text(panel->surface, font_surface, 10, 10, panel->text);
+        panel->valid = 1;
+    }
+    return panel->surface;
+}
+
+// Sub-rectangle of the screen as a surface of its own: it shares the screen's pixels, pitch and
+// format, so renderers draw into it as into any surface and no copy to the screen is needed
+typedef struct {
+    SDL_Surface* surface;
+    int offset;              // Bytes from the start of the screen pixels
+} ScreenView;
+
+ScreenView screenViews[MAX_SCREEN_VIEWS];
+int numScreenViews = 0;
+int directCompositing = DIRECT_COMPOSITING;
+
+// Create a view of a rectangle of the screen
+SDL_Surface* create_screen_view(SDL_Surface* screen, SDL_Rect rect) {
+    if (numScreenViews == MAX_SCREEN_VIEWS) return NULL;
+    ScreenView* view = &screenViews[numScreenViews];
+    SDL_PixelFormat* fmt = screen->format;
+    view->offset = rect.y * screen->pitch + rect.x * fmt->BytesPerPixel;
+
+    if (SDL_LockSurface(screen) < 0) return NULL;
+    view->surface = SDL_CreateRGBSurfaceFrom((Uint8*)screen->pixels + view->offset, rect.w, rect.h, fmt->BitsPerPixel,
+                                             screen->pitch, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0);
+    SDL_UnlockSurface(screen);
+    if (!view->surface) return NULL;
+    numScreenViews++;
+    return view->surface;
+}
+
+// Lock the screen for drawing through its views. The screen pixels only stay put while it is
+// locked, so the views are pointed at them again; nothing may blit to the screen itself until
+// unlock_screen_views().
+void lock_screen_views(SDL_Surface* screen) {
+    if (numScreenViews == 0 || SDL_LockSurface(screen) < 0) return;
+    for (int i = 0; i < numScreenViews; i++) {
+        screenViews[i].surface->pixels = (Uint8*)screen->pixels + screenViews[i].offset;
+    }
+}
+
+// Unlock the screen after drawing through its views
+void unlock_screen_views(SDL_Surface* screen) {
+    if (numScreenViews > 0 && screen->locked) SDL_UnlockSurface(screen);
+}
+
+// Free the views, the screen pixels stay
+void free_screen_views(void) {
+    for (int i = 0; i < numScreenViews; i++) SDL_FreeSurface(screenViews[i].surface);
+    numScreenViews = 0;
+}
+
+// Frame pacer and rolling frame-time statistics
+typedef struct {
+    Uint64 deadline;                     // When the current frame should be presented
+    Uint64 lastPresent;                  // End of the previous paced frame
+    Uint64 history[FRAME_HISTORY];       // Ring of recent frame times
+    int historyNext;
+    int historyCount;
+    Uint64 historyTotal;
+    int buckets[FRAME_BUCKETS];          // Histogram of the frames in the ring
+    int dropped;                         // Frames in the ring that missed their slot
+} FramePacer;
+
+FramePacer pacer;
+int showFrameStats = 0;
+
+// Histogram bucket of a frame time
+int frame_bucket(Uint64 frameNs) {
+    Uint64 bucket = frameNs / FRAME_BUCKET_NS;
+    return bucket < FRAME_BUCKETS ? (int)bucket : FRAME_BUCKETS - 1;
+}
+
+// Check if a frame time missed its display slot
+int frame_dropped(Uint64 frameNs) {
+    return frameNs > FRAME_PERIOD_NS + FRAME_PERIOD_NS / 2;
+}
+
+// Add a frame time to the ring, dropping the oldest
+void record_frame_time(Uint64 frameNs) {
+    if (pacer.historyCount == FRAME_HISTORY) {
+        Uint64 oldest = pacer.history[pacer.historyNext];
+        pacer.historyTotal -= oldest;
+        pacer.buckets[frame_bucket(oldest)]--;
+        pacer.dropped -= frame_dropped(oldest);
+    } else {
+        pacer.historyCount++;
+    }
+    pacer.history[pacer.historyNext] = frameNs;
+    pacer.historyNext = (pacer.historyNext + 1) % FRAME_HISTORY;
+    pacer.historyTotal += frameNs;
+    pacer.buckets[frame_bucket(frameNs)]++;
+    pacer.dropped += frame_dropped(frameNs);
+}
+
+// Restart pacing from now, after the loop slept waiting for input
+void pacer_reset(void) {
+    pacer.lastPresent = get_time_ns();
+    pacer.deadline = pacer.lastPresent + FRAME_PERIOD_NS;
+}
+
+// Wait for the frame deadline: sleep most of the way, then spin on the clock
+void pace_frame(void) {
+    Uint64 now = get_time_ns();
+    if (now + PACE_SPIN_NS < pacer.deadline) {
+        Uint64 sleepNs = pacer.deadline - now - PACE_SPIN_NS;
+        struct timespec ts = { (time_t)(sleepNs / 1000000000ULL), (long)(sleepNs % 1000000000ULL) };
+        nanosleep(&ts, NULL);
+    }
+    while ((now = get_time_ns()) < pacer.deadline) {
+    }
+
+    record_frame_time(now - pacer.lastPresent);
+    pacer.lastPresent = now;
+
+    // Late frames resynchronise instead of rushing to catch up
+    pacer.deadline += FRAME_PERIOD_NS;
+    if (pacer.deadline < now) pacer.deadline = now + FRAME_PERIOD_NS;
+}
+
+// Frame time at or below which a share of the recorded frames fall, from the histogram
+Uint64 frame_percentile(int percent) {
+    int target = (pacer.historyCount * percent + 99) / 100;
+    int seen = 0;
+    for (int i = 0; i < FRAME_BUCKETS; i++) {
+        seen += pacer.buckets[i];
+        if (seen >= target) return (Uint64)(i + 1) * FRAME_BUCKET_NS;
+    }
+    return (Uint64)FRAME_BUCKETS * FRAME_BUCKET_NS;
+}
+
+// Draw the frame-time statistics onto an overlay surface
+void draw_frame_stats(SDL_Surface* overlay, SDL_Surface* font_surface) {
+    char text[128];
+    double average = pacer.historyCount ? pacer.historyTotal / 1e6 / pacer.historyCount : 0.0;
+    snprintf(text, sizeof(text), "fps  %.1f\navg  %.2f ms\np95  %.2f ms\np99  %.2f ms\ndrop %d",
+             average > 0 ? 1000.0 / average : 0.0, average,
+             frame_percentile(95) / 1e6, frame_percentile(99) / 1e6, pacer.dropped);
+
+    SDL_FillRect(overlay, NULL, SDL_MapRGB(overlay->format, 200, 80, 30));
+    draw_text(overlay, font_surface, 4, 4, text);
+}
+
+// Release the current map
+void unload_map(void) {
+    chunk_store_stop();
+    event_index_clear();
+    walk_map_clear();
+    dist_fields_clear();
+    explored_map_clear();
+    invalidate_layer();
+    if (mapMapping) {
+        munmap(mapMapping, mapMappingSize);
+    } else {
+        free(worldMap);
+    }
+    mapMapping = NULL;
+    mapMappingSize = 0;
+    ceilingMap = NULL;
+    worldMap = NULL;
+    mapWidth = 0;
+    mapHeight = 0;
+}
+
+// Allocate an empty map
+int create_map(int width, int height) {
+    unload_map();
+    worldMap = calloc((size_t)width * height, sizeof(Cell));
+    if (!worldMap) return 0;
+    mapWidth = width;
+    mapHeight = height;
+    event_index_clear();
+    return walk_map_start() && explored_map_start() && chunk_store_start();
+}
+
+// Read little-endian header fields, whatever the byte order of the machine
+Uint16 read_le16(const Uint8* bytes) {
+    return (Uint16)(bytes[0] | (bytes[1] << 8));
+}
+
+Uint32 read_le32(const Uint8* bytes) {
+    return (Uint32)bytes[0] | ((Uint32)bytes[1] << 8) | ((Uint32)bytes[2] << 16) | ((Uint32)bytes[3] << 24);
+}
+
+// Load the map, either a versioned map file or a legacy raw MAP_WIDTH x MAP_HEIGHT map
+int load_map(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open map file: %s\n", filename);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("Failed to read map file: %s\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    // Private writable mapping: pages stay shared with the file until a cell is changed
+    size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Failed to map file: %s\n", filename);
+        return 0;
+    }
+
+    size_t width, height, offset, ceilingOffset = 0;
+    const Uint8* header = mapping;
+    if (size >= sizeof(MapHeader) && memcmp(header, MAP_MAGIC, 4) == 0) {
+        int version = read_le16(header + offsetof(MapHeader, version));
+        size_t headerSize = read_le16(header + offsetof(MapHeader, headerSize));
+        if (version != MAP_VERSION || headerSize < sizeof(MapHeader)) {
+            printf("Unsupported map version %d in %s\n", version, filename);
+            munmap(mapping, size);
+            return 0;
+        }
+        width = read_le32(header + offsetof(MapHeader, width));
+        height = read_le32(header + offsetof(MapHeader, height));
+        offset = read_le32(header + offsetof(MapHeader, layerOffset) + MAP_LAYER_CELLS * sizeof(uint32_t));
+        ceilingOffset = read_le32(header + offsetof(MapHeader, layerOffset) + MAP_LAYER_CEILING * sizeof(uint32_t));
+
+        // The cell layer is required, the ceiling layer may be absent. Neither may overlap the header
+        if (offset < headerSize) {
+            printf("Missing cell layer in %s\n", filename);
+            munmap(mapping, size);
+            return 0;
+        }
+        if (ceilingOffset != 0 && ceilingOffset < headerSize) {
+            printf("Bad ceiling layer in %s\n", filename);
+            munmap(mapping, size);
+            return 0;
+        }
+    } else {
+        width = MAP_WIDTH;
+        height = MAP_HEIGHT;
+        offset = 0;
+    }
+
+    // The layers must lie inside the file, the cell layer aligned
+    if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF ||
+        offset % sizeof(Cell) != 0 || offset > size || (size - offset) / sizeof(Cell) / width < height ||
+        (ceilingOffset && (ceilingOffset > size || (size - ceilingOffset) / width < height))) {
+        printf("Error reading map data from %s\n", filename);
+        munmap(mapping, size);
+        return 0;
+    }
+
+    unload_map();
+    mapMapping = mapping;
+    mapMappingSize = size;
+    worldMap = (Cell*)((Uint8*)mapping + offset);
+    ceilingMap = ceilingOffset ? (const Uint8*)mapping + ceilingOffset : NULL;
+    mapWidth = (int)width;
+    mapHeight = (int)height;
+    if (!chunk_store_start() || !walk_map_start() || !explored_map_start()) {
+        printf("Unable to allocate map chunks for %s\n", filename);
+        unload_map();
+        return 0;
+    }
+
+    printf("Map loaded successfully from %s (%dx%d)\n", filename, mapWidth, mapHeight);
+    return 1;
+}
+
+// Raycaster threading (see RENDER_THREADS and RENDER_BAND_WIDTH)
+int renderThreads = RENDER_THREADS;
+int renderBandWidth = RENDER_BAND_WIDTH;
+int raySimd = RAY_SIMD;
+int rayFixed = RAY_FIXED;
+
+// Texture cache: atlas tiles converted to the render format, stored column-major, each followed
+// by its mip levels (mipOffset) so the tile itself starts at textureCache[t]
+Uint32 textureCache[TEXTURE_INDEX_MASK + 1][TEXTURE_TEXELS];
+int mipOffset[MIP_LEVELS];
+int textureMipmaps = TEXTURE_MIPMAPS;
+Uint32 textureCacheMasks[3]; // RGB masks of the format the cache was built for
+Uint8 textureCacheShifts[3];  // RGB shifts of the same format
+int textureCacheValid = 0;
+
+// Opacity of each cached texture column, one bit per texel row (TILE_SIZE <= 32)
+Uint32 textureOpaque[TEXTURE_INDEX_MASK + 1][TILE_SIZE];
+
+// Light tables: each 8-bit channel value scaled by each light level
+Uint8 lightTable[LIGHT_LEVELS][256];
+
+// Distance-to-light curve (shading = 1 / (distance * falloff + 1))
+double wallLightFalloff = WALL_LIGHT_FALLOFF;
+double floorLightFalloff = FLOOR_LIGHT_FALLOFF;
+
+// Build light tables
+void build_light_tables(void) {
+    for (int level = 0; level < LIGHT_LEVELS; level++) {
+        for (int c = 0; c < 256; c++) {
+            lightTable[level][c] = (Uint8)((c * level) / (LIGHT_LEVELS - 1));
+        }
+    }
+}
+
+// Get light level for a distance
+int light_level(double distance, double falloff) {
+    double shadingFactor = 1.0 / (distance * falloff + 1.0);
+
+    // Clamp shadingFactor between 0 and 1
+    if (shadingFactor < 0.0) shadingFactor = 0.0;
+    if (shadingFactor > 1.0) shadingFactor = 1.0;
+
+    return (int)(shadingFactor * (LIGHT_LEVELS - 1) + 0.5);
+}
+
+// Get light level for a 16.16 distance and falloff, integer only
+int light_level_fixed(Sint64 distance, Sint64 falloff) {
+    Sint64 denominator = FIXED_ONE + ((distance * falloff) >> FIXED_SHIFT);
+    if (denominator < FIXED_ONE) return LIGHT_LEVELS - 1;
+    Sint64 numerator = (Sint64)(LIGHT_LEVELS - 1) * FIXED_ONE;
+    return (int)((2 * numerator + denominator) / (2 * denominator));
+}
+
+// Sine of TRIG_STEPS angles per turn in 16.16, built with integer arithmetic only
+Sint32 sinTable[TRIG_STEPS];
+int sinTableValid = 0;
+
+// Fill the sine table from a Taylor series in Q30
+void build_sin_table(void) {
+    const Uint64 halfPi = 1686629713ULL; // pi / 2 in Q30
+    int quarter = TRIG_STEPS / 4;
+
+    for (int i = 0; i <= quarter; i++) {
+        Uint64 angle = halfPi * i / quarter;
+        Uint64 angleSquared = (angle * angle) >> 30;
+        Uint64 term = angle;
+        Sint64 sum = 0;
+        for (int k = 1; term != 0; k++) {
+            sum += (k & 1) ? (Sint64)term : -(Sint64)term;
+            term = ((term * angleSquared) >> 30) / ((2 * k) * (2 * k + 1));
+        }
+        Sint32 value = (Sint32)((sum + (1 << 13)) >> 14);
+
+        // Mirror the first quarter into the rest of the turn
+        sinTable[i] = value;
+        sinTable[TRIG_STEPS / 2 - i] = value;
+        sinTable[(TRIG_STEPS / 2 + i) % TRIG_STEPS] = -value;
+        sinTable[(TRIG_STEPS - i) % TRIG_STEPS] = -value;
+    }
+    sinTableValid = 1;
+}
+
+// Convert an angle in radians to a sine table index
+int trig_index(double angle) {
+    return (int)floor(angle * (TRIG_STEPS / (2 * M_PI)) + 0.5) & (TRIG_STEPS - 1);
+}
+
+// Mip level of a wall stripe lineHeight pixels tall: one level down for every doubling of the
+// texels per pixel past one
+int wall_mip_level(int lineHeight) {
+    int level = 0;
+    if (!textureMipmaps) return 0;
+    while (level < MIP_LEVELS - 1 && (lineHeight << (level + 1)) <= TILE_SIZE) level++;
+    return level;
+}
+
+// Floor distance of each viewport row below the horizon in 16.16, for one viewport height
+Sint32 rowDistanceTable[RESO_Y];
+int rowDistanceHeight = 0;
+
+// Fill the row distance table for a viewport height
+void build_row_distances(int viewport_height) {
+    for (int y = viewport_height / 2 + 1; y < viewport_height; y++) {
+        rowDistanceTable[y] = (Sint32)(((Sint64)viewport_height << FIXED_SHIFT) / (2 * y - viewport_height));
+    }
+    rowDistanceHeight = viewport_height;
+}
+
+// Mip level of each floor row below the horizon, for one viewport size, caster and setting
+Uint8 rowMipLevel[RESO_Y];
+int rowMipWidth = 0;
+int rowMipHeight = 0;
+int rowMipFixed = -1;
+int rowMipEnabled = -1;
+
+// Pick the floor level of every row from the texels one pixel spans: across the row at the
+// row's distance, or towards the next row, whichever is larger. The fixed-point caster takes
+// its distances from rowDistanceTable, so build_row_distances() must have run for this height.
+void build_row_mip_levels(int viewport_width, int viewport_height, int fixed) {
+    for (int y = viewport_height / 2 + 1; y < viewport_height; y++) {
+        int level = 0;
+        if (fixed) {
+            // Footprints in 16.16 texels
+            Sint64 dist = rowDistanceTable[y];
+            Sint64 nextDist = ((Sint64)viewport_height << FIXED_SHIFT) / (2 * y + 2 - viewport_height);
+            Sint64 planeLength = (Sint64)(FOV_FACTOR * FIXED_ONE);
+            Sint64 across = dist * planeLength * 2 * TILE_SIZE / viewport_width >> FIXED_SHIFT;
+            Sint64 along = (dist - nextDist) * TILE_SIZE;
+            Sint64 footprint = across > along ? across : along;
+            while (level < MIP_LEVELS - 1 && footprint >= 2 * FIXED_ONE) {
+                footprint >>= 1;
+                level++;
+            }
+        } else {
+            double dist = (double)viewport_height / (2.0 * y - viewport_height);
+            double nextDist = (double)viewport_height / (2.0 * y + 2 - viewport_height);
+            double across = dist * 2.0 * FOV_FACTOR / viewport_width * TILE_SIZE;
+            double along = (dist - nextDist) * TILE_SIZE;
+            double footprint = across > along ? across : along;
+            while (level < MIP_LEVELS - 1 && footprint >= 2.0) {
+                footprint *= 0.5;
+                level++;
+            }
+        }
+        rowMipLevel[y] = textureMipmaps ? level : 0;
+    }
+    rowMipWidth = viewport_width;
+    rowMipHeight = viewport_height;
+    rowMipFixed = fixed;
+    rowMipEnabled = textureMipmaps;
+}
+
+// Shade a cached texel with a light table
+Uint32 shade_pixel(Uint32 color, const Uint8* light) {
+    return ((Uint32)light[(color >> textureCacheShifts[0]) & 0xFF] << textureCacheShifts[0]) |
+           ((Uint32)light[(color >> textureCacheShifts[1]) & 0xFF] << textureCacheShifts[1]) |
+           ((Uint32)light[(color >> textureCacheShifts[2]) & 0xFF] << textureCacheShifts[2]);
+}
+
+// Get texture atlas
+SDL_Surface* texture_atlas = NULL;
+void load_texture_atlas(const char* atlas_filename) {
+    texture_atlas = IMG_Load(atlas_filename);
+    if (!texture_atlas) {
+        printf("Failed to load texture atlas: %s\n", IMG_GetError());
+        SDL_Quit();
+        exit(1);
+    }
+
+    // Cache is rebuilt on the next frame
+    textureCacheValid = 0;
+}
+
+// Copy each atlas tile into the texture cache in the given pixel format
+void build_texture_cache(const SDL_PixelFormat* format) {
+    int atlasColumns = texture_atlas->w / TILE_SIZE;
+    int atlasRows = texture_atlas->h / TILE_SIZE;
+
+    // Tiles missing from the atlas stay black
+    memset(textureCache, 0, sizeof(textureCache));
+    memset(textureOpaque, 0, sizeof(textureOpaque));
+
+    // Level l is (TILE_SIZE >> l) texels square and follows the larger levels
+    for (int level = 0, offset = 0; level < MIP_LEVELS; level++) {
+        mipOffset[level] = offset;
+        offset += (TILE_SIZE >> level) * (TILE_SIZE >> level);
+    }
+
+    for (int t = 0; t <= TEXTURE_INDEX_MASK; t++) {
+        int texCol = t % ATLAS_COLUMNS;
+        int texRow = t / ATLAS_COLUMNS;
+        if (texCol >= atlasColumns || texRow >= atlasRows) continue;
+
+        // Colors of the current level, column-major like the cache
+        Uint8 rgb[TILE_SIZE * TILE_SIZE][3];
+        for (int ty = 0; ty < TILE_SIZE; ty++) {
+            Uint8* row = (Uint8*)texture_atlas->pixels + (texRow * TILE_SIZE + ty) * texture_atlas->pitch;
+            Uint32* pixels = (Uint32*)row + texCol * TILE_SIZE;
+
+            for (int tx = 0; tx < TILE_SIZE; tx++) {
+                Uint8* c = rgb[tx * TILE_SIZE + ty];
+                Uint8 a;
+                SDL_GetRGBA(pixels[tx], texture_atlas->format, &c[0], &c[1], &c[2], &a);
+                textureCache[t][tx * TILE_SIZE + ty] = SDL_MapRGB(format, c[0], c[1], c[2]);
+                if (a >= 128) textureOpaque[t][tx] |= (Uint32)1 << ty;
+            }
+        }
+
+        // Each further level averages 2x2 texels of the one before, in place
+        for (int level = 1; level < MIP_LEVELS; level++) {
+            int size = TILE_SIZE >> level;
+            Uint32* mip = textureCache[t] + mipOffset[level];
+            for (int tx = 0; tx < size; tx++) {
+                for (int ty = 0; ty < size; ty++) {
+                    const Uint8* a = rgb[(2 * tx) * (2 * size) + 2 * ty];
+                    const Uint8* b = rgb[(2 * tx + 1) * (2 * size) + 2 * ty];
+                    Uint8* c = rgb[tx * size + ty];
+                    Uint8 mixed[3];
+                    for (int ch = 0; ch < 3; ch++) {
+                        mixed[ch] = (Uint8)((a[ch] + a[3 + ch] + b[ch] + b[3 + ch] + 2) / 4);
+                    }
+                    memcpy(c, mixed, 3);
+                    mip[tx * size + ty] = SDL_MapRGB(format, mixed[0], mixed[1], mixed[2]);
+                }
+            }
+        }
+    }
+
+    textureCacheMasks[0] = format->Rmask;
+    textureCacheMasks[1] = format->Gmask;
+    textureCacheMasks[2] = format->Bmask;
+    textureCacheShifts[0] = format->Rshift;
+    textureCacheShifts[1] = format->Gshift;
+    textureCacheShifts[2] = format->Bshift;
+    textureCacheValid = 1;
+}
+
+// Build texture cache if missing or made for another format
+void ensure_texture_cache(const SDL_PixelFormat* format) {
+    if (!textureCacheValid || textureCacheMasks[0] != format->Rmask ||
+        textureCacheMasks[1] != format->Gmask || textureCacheMasks[2] != format->Bmask) {
+        build_texture_cache(format);
+    }
+}
+
+// Get player sprite
+SDL_Surface* playerSprite = NULL;
+void load_player_sprite(const char* spritename) {
+    playerSprite = IMG_Load(spritename);
+    if (!playerSprite) {
+        printf("Failed to load player sprite: %s\n", IMG_GetError());
+        SDL_Quit();
+        exit(1);
+    }
+}
+
+// Initialize the map
+void initialize_worldMap(const char* filename, const char* atlasname) {
+    if (!load_map(filename)) {
+        printf("Failed to load map. Initializing default map.\n");
+        if (!create_map(MAP_WIDTH, MAP_HEIGHT)) {
+            printf("Unable to allocate map\n");
+            SDL_Quit();
+            exit(1);
+        }
+
+        for (int x = 0; x < MAP_WIDTH; x++) {
+            for (int y = 0; y < MAP_HEIGHT; y++) {
+                if (x == 0 || y == 0 || x == MAP_WIDTH - 1 || y == MAP_HEIGHT - 1) {
+                    set_cell(x, y, (Cell){1, 0});  // Set tileByte for walls, no event
+                } else {
+                    set_cell(x, y, (Cell){0, 0});  // Set tileByte for empty space, no event
+                }
+            }
+        }
+
+        // Load texture atlas
+        load_texture_atlas(atlasname);
+
+        for (int x = 5; x < 19; x++) {
+            set_cell(x, 10, (Cell){1, 0});  // Set tileByte for walls, no event
+        }
+    } else {
+        load_texture_atlas(atlasname);
+    }
+}
+
+// Get pixel from a surface
+Uint32 get_pixel(SDL_Surface *surface, int x, int y) {
+    if (x < 0 || x >= surface->w || y < 0 || y >= surface->h)
+        return 0; // Out of bounds returns black
+
+    Uint32 pixel;
+    Uint8 r, g, b;
+
+    // Calculate pixel address, rows are pitch bytes apart
+    Uint32 *pixels = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch);
+    pixel = pixels[x];
+
+    // Juggling color channels
+    SDL_GetRGB(pixel, surface->format, &b, &g, &r);
+    return SDL_MapRGB(surface->format, r, g, b);
+}
+
+// Put a pixel onto a surface
+void put_pixel(SDL_Surface *surface, int x, int y, Uint32 pixel) {
+    if (x < 0 || x >= surface->w || y < 0 || y >= surface->h)
+        return;
+
+    Uint32 *pixels = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch);
+    pixels[x] = pixel;
+}
+
+// Player directions
+typedef enum {
+    NORTH,
+    EAST,
+    SOUTH,
+    WEST
+} Direction;
+
+// Logical position and direction (grid-aligned)
+int gridX = 12;
+int gridY = 12;
+Direction gridDir = NORTH;
+
+// Event bytecode instructions, operands follow the opcode (16-bit values little-endian)
+typedef enum {
+    OP_END,          // Stop the script
+    OP_TEXT,         // u16 string: show a message in the dialogue box
+    OP_SET_TILE,     // u16 x, u16 y, u8 tile byte
+    OP_SET_EVENT,    // u16 x, u16 y, u8 event byte
+    OP_CLEAR_EVENT,  // Remove the event from the triggering cell
+    OP_TELEPORT,     // u16 x, u16 y
+    OP_SET_FLAG,     // u8 flag
+    OP_CLEAR_FLAG,   // u8 flag
+    OP_JUMP,         // u16 target
+    OP_JUMP_IF,      // u8 flag, u16 target
+    OP_JUMP_UNLESS   // u8 flag, u16 target
+} EventOp;
+
+// Compiled event scripts of the current map
+Uint8 eventCode[EVENT_CODE_MAX];
+int eventCodeSize = 0;
+char eventStrings[EVENT_STRINGS_MAX];
+int eventStringsSize = 0;
+Sint32 eventScripts[EVENT_TYPES][EVENT_IDS]; // Code offset per event type and id, -1 for none
+Uint8 eventFlags[EVENT_FLAGS / 8];
+const char* eventMessage = NULL;             // Message waiting for the dialogue box
+const char* eventScriptError = NULL;         // Why the last script file was rejected
+
+// Forget all compiled scripts
+void clear_event_scripts(void) {
+    eventCodeSize = 0;
+    eventStringsSize = 0;
+    memset(eventScripts, 0xFF, sizeof(eventScripts));
+    memset(eventFlags, 0, sizeof(eventFlags));
+    eventMessage = NULL;
+}
+
+// Append a byte to the event bytecode
+int emit_event_byte(int value) {
+    if (eventCodeSize >= EVENT_CODE_MAX) return 0;
+    eventCode[eventCodeSize++] = (Uint8)value;
+    return 1;
+}
+
+// Append a 16-bit operand to the event bytecode
+int emit_event_word(int value) {
+    return emit_event_byte(value & 0xFF) && emit_event_byte(value >> 8);
+}
+
+// Read a 16-bit operand
+int read_event_word(int pc) {
+    return eventCode[pc] | (eventCode[pc + 1] << 8);
+}
+
+// Compile an event script file. Each line holds one statement, # starts a comment:
+//   event <type> <id>      start the script run by cells with this event type and id
+//   text <message>         show the rest of the line in the dialogue box (\n breaks lines)
+//   tile <x> <y> <byte>    set the tile byte of a cell
+//   mark <x> <y> <byte>    set the event byte of a cell
+//   clear                  remove the event from the cell that triggered the script
+//   teleport <x> <y>       move the party
+//   set <flag>, unset <flag>
+//   label <name>, goto <name>, if <flag> <name>, unless <flag> <name>
+//   end                    finish the script
+// On error the scripts are cleared and eventScriptError names the problem.
+int compile_event_scripts(FILE* file, const char* filename) {
+    clear_event_scripts();
+    eventScriptError = NULL;
+
+    char line[512];
+    int lineNumber = 0;
+    int inScript = 0;
+    char labels[EVENT_LABELS_MAX][32];
+    int labelOffsets[EVENT_LABELS_MAX];
+    int numLabels = 0;
+    char fixupLabels[EVENT_LABELS_MAX][32];
+    int fixupOffsets[EVENT_LABELS_MAX];
+    int numFixups = 0;
+    const char* error = NULL;
+
+    while (!error && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char command[16], name[32];
+        int a = 0, b = 0, c = 0, used = 0;
+        char* start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#') continue;
+        if (sscanf(start, "%15s%n", command, &used) != 1) continue;
+        char* args = start + used;
+
+        if (strcmp(command, "event") == 0) {
+            if (inScript) { error = "missing end"; break; }
+            if (sscanf(args, "%i %i", &a, &b) != 2 || a < 0 || a >= EVENT_TYPES || b < 0 || b >= EVENT_IDS) {
+                error = "bad event type or id";
+                break;
+            }
+            eventScripts[a][b] = eventCodeSize;
+            inScript = 1;
+            numLabels = 0;
+            numFixups = 0;
+            continue;
+        }
+        if (!inScript) { error = "statement outside an event"; break; }
+
+        if (strcmp(command, "end") == 0) {
+            if (!emit_event_byte(OP_END)) { error = "script too large"; break; }
+
+            // Resolve jumps to labels of this script
+            for (int i = 0; i < numFixups && !error; i++) {
+                int target = -1;
+                for (int j = 0; j < numLabels; j++) {
+                    if (strcmp(labels[j], fixupLabels[i]) == 0) target = labelOffsets[j];
+                }
+                if (target < 0) error = "unknown label";
+                eventCode[fixupOffsets[i]] = (Uint8)(target & 0xFF);
+                eventCode[fixupOffsets[i] + 1] = (Uint8)(target >> 8);
+            }
+            inScript = 0;
+        } else if (strcmp(command, "text") == 0) {
+            // Copy the message, turning \n into line breaks
+            char* message = args + strspn(args, " \t");
+            int offset = eventStringsSize;
+            char* p = message;
+            for (; *p && eventStringsSize < EVENT_STRINGS_MAX - 1; p++) {
+                if (p[0] == '\\' && p[1] == 'n') {
+                    eventStrings[eventStringsSize++] = '\n';
+                    p++;
+                } else {
+                    eventStrings[eventStringsSize++] = *p;
+                }
+            }
+            if (*p != '\0') { error = "too much text"; break; }
+            eventStrings[eventStringsSize++] = '\0';
+            if (!emit_event_byte(OP_TEXT) || !emit_event_word(offset)) error = "script too large";
+        } else if (strcmp(command, "tile") == 0 || strcmp(command, "mark") == 0) {
+            if (sscanf(args, "%i %i %i", &a, &b, &c) != 3 || a < 0 || a > 0xFFFF || b < 0 || b > 0xFFFF || c < 0 || c > 0xFF) {
+                error = "expected x, y and a byte";
+                break;
+            }
+            EventOp op = command[0] == 't' ? OP_SET_TILE : OP_SET_EVENT;
+            if (!emit_event_byte(op) || !emit_event_word(a) || !emit_event_word(b) || !emit_event_byte(c)) error = "script too large";
+        } else if (strcmp(command, "clear") == 0) {
+            if (!emit_event_byte(OP_CLEAR_EVENT)) error = "script too large";
+        } else if (strcmp(command, "teleport") == 0) {
+            if (sscanf(args, "%i %i", &a, &b) != 2 || a < 0 || a > 0xFFFF || b < 0 || b > 0xFFFF) {
+                error = "expected x and y";
+                break;
+            }
+            if (!emit_event_byte(OP_TELEPORT) || !emit_event_word(a) || !emit_event_word(b)) error = "script too large";
+        } else if (strcmp(command, "set") == 0 || strcmp(command, "unset") == 0) {
+            if (sscanf(args, "%i", &a) != 1 || a < 0 || a >= EVENT_FLAGS) { error = "bad flag"; break; }
+            if (!emit_event_byte(command[0] == 's' ? OP_SET_FLAG : OP_CLEAR_FLAG) || !emit_event_byte(a)) error = "script too large";
+        } else if (strcmp(command, "label") == 0) {
+            if (sscanf(args, "%31s", name) != 1 || numLabels == EVENT_LABELS_MAX) { error = "bad label"; break; }
+            strcpy(labels[numLabels], name);
+            labelOffsets[numLabels++] = eventCodeSize;
+        } else if (strcmp(command, "goto") == 0 || strcmp(command, "if") == 0 || strcmp(command, "unless") == 0) {
+            int ok;
+            if (command[0] == 'g') {
+                ok = sscanf(args, "%31s", name) == 1 && emit_event_byte(OP_JUMP) && emit_event_word(0);
+            } else {
+                ok = sscanf(args, "%i %31s", &a, name) == 2 && a >= 0 && a < EVENT_FLAGS &&
+                     emit_event_byte(command[0] == 'i' ? OP_JUMP_IF : OP_JUMP_UNLESS) && emit_event_byte(a) && emit_event_word(0);
+            }
+            if (!ok || numFixups == EVENT_LABELS_MAX) { error = "bad jump"; break; }
+            strcpy(fixupLabels[numFixups], name);
+            fixupOffsets[numFixups++] = eventCodeSize - 2;
+        } else {
+            error = "unknown statement";
+        }
+    }
+
+    if (!error && inScript) error = "missing end";
+    if (error) {
+        printf("Event script error in %s at line %d: %s\n", filename, lineNumber, error);
+        clear_event_scripts();
+        eventScriptError = error;
+        return 0;
+    }
+    printf("Event scripts loaded from %s (%d bytes)\n", filename, eventCodeSize);
+    return 1;
+}
+
+// Compile the event scripts of the map. Missing files leave the map without scripts.
+int load_event_scripts(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        clear_event_scripts();
+        return 0;
+    }
+    int ok = compile_event_scripts(file, filename);
+    fclose(file);
+    return ok;
+}
+
+// Compile the event scripts of a map file, kept next to it with the extension .evt
+int load_map_event_scripts(const char* mapFilename) {
+    const char* dot = strrchr(mapFilename, '.');
+    const char* slash = strrchr(mapFilename, '/');
+    int length = dot && (!slash || dot > slash) ? (int)(dot - mapFilename) : (int)strlen(mapFilename);
+    char path[512];
+    if (snprintf(path, sizeof(path), "%.*s.evt", length, mapFilename) >= (int)sizeof(path)) {
+        printf("Map file name too long: %s\n", mapFilename);
+        clear_event_scripts();
+        return 0;
+    }
+    return load_event_scripts(path);
+}
+
+// Run the script of an event, triggered by the cell at x, y
+void run_event_script(int type, int id, int x, int y) {
+    int pc = eventScripts[type][id];
+    if (pc < 0) return;
+
+    for (int steps = 0; steps < EVENT_STEP_LIMIT; steps++) {
+        Uint8 op = eventCode[pc++];
+        switch (op) {
+            case OP_END:
+                return;
+            case OP_TEXT:
+                eventMessage = &eventStrings[read_event_word(pc)];
+                pc += 2;
+                break;
+            case OP_SET_TILE:
+            case OP_SET_EVENT: {
+                int cx = read_event_word(pc);
+                int cy = read_event_word(pc + 2);
+                if (in_map(cx, cy)) {
+                    Cell cell = get_cell(cx, cy);
+                    if (op == OP_SET_TILE) cell.tileByte = eventCode[pc + 4];
+                    else cell.eventByte = eventCode[pc + 4];
+                    set_cell(cx, cy, cell);
+                    mark_dirty(REGION_VIEWPORT);
+                }
+                pc += 5;
+                break;
+            }
+            case OP_CLEAR_EVENT: {
+                Cell cell = get_cell(x, y);
+                cell.eventByte = 0;
+                set_cell(x, y, cell);
+                break;
+            }
+            case OP_TELEPORT: {
+                int tx = read_event_word(pc);
+                int ty = read_event_word(pc + 2);
+                pc += 4;
+                if (!in_map(tx, ty)) break;
+                gridX = tx;
+                gridY = ty;
+                playerX = targetX = tx + 0.5;
+                playerY = targetY = ty + 0.5;
+                isMoving = 0;
+                mark_dirty(REGION_VIEWPORT);
+                break;
+            }
+            case OP_SET_FLAG:
+                eventFlags[eventCode[pc] >> 3] |= 1 << (eventCode[pc] & 7);
+                pc++;
+                break;
+            case OP_CLEAR_FLAG:
+                eventFlags[eventCode[pc] >> 3] &= ~(1 << (eventCode[pc] & 7));
+                pc++;
+                break;
+            case OP_JUMP:
+                pc = read_event_word(pc);
+                break;
+            case OP_JUMP_IF:
+            case OP_JUMP_UNLESS: {
+                int set = (eventFlags[eventCode[pc] >> 3] >> (eventCode[pc] & 7)) & 1;
+                pc = set == (op == OP_JUMP_IF) ? read_event_word(pc + 1) : pc + 3;
+                break;
+            }
+            default:
+                printf("Bad event opcode %d at %d\n", op, pc - 1);
+                return;
+        }
+    }
+    printf("Event %d/%d stopped after %d steps\n", type, id, EVENT_STEP_LIMIT);
+}
+
+// Run the event of the cell the party steps onto, if it has one
+void trigger_event(int x, int y) {
+    Uint8 eventByte = event_at(x, y);
+    if (eventByte) {
+        Cell cell = { 0, eventByte };
+        run_event_script(get_event_type(cell), get_event_id(cell), x, y);
+    }
+}
+
+// Movement Functions (for raycaster)
+void initiate_move_forward(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        // Determine target grid position
+        int newX = gridX;
+        int newY = gridY;
+
+        // Move in the direction the player is facing
+        switch (gridDir) {
+            case NORTH: newX += 1; break; // Move up (north)
+            case EAST:  newY -= 1; break; // Move right (east)
+            case SOUTH: newX -= 1; break; // Move down (south)
+            case WEST:  newY += 1; break; // Move left (west)
+        }
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+void initiate_move_backward(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        int newX = gridX;
+        int newY = gridY;
+
+        switch (gridDir) {
+            case NORTH: newX -= 1; break;
+            case EAST:  newY += 1; break;
+            case SOUTH: newX += 1; break;
+            case WEST:  newY -= 1; break;
+        }
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+void initiate_turn_left(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        isRotating = 1;
+        rotateStartTime = currentTime;
+        startAngle = dirAngle;
+        gridDir = (gridDir + 1) % 4;
+        targetAngle = startAngle - (M_PI / 2);
+    }
+}
+
+void initiate_turn_right(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        isRotating = 1;
+        rotateStartTime = currentTime;
+        startAngle = dirAngle;
+        gridDir = (gridDir + 3) % 4;
+        targetAngle = startAngle + (M_PI / 2); 
+    }
+}
+
+// Movement functions (for topdown view)
+void initiate_move_up(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        int newX = gridX;
+        int newY = gridY - 1; 
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+void initiate_move_down(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        int newX = gridX;
+        int newY = gridY + 1; 
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+void initiate_move_right(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        int newX = gridX + 1;
+        int newY = gridY;
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+void initiate_move_left(Uint32 currentTime) {
+    if (!isMoving && !isRotating) {
+        int newX = gridX - 1;
+        int newY = gridY;
+
+        // Check for collision (is walkable?)
+        if (cell_walkable(newX, newY)) {
+            isMoving = 1;
+            moveStartTime = currentTime;
+            startX = playerX;
+            startY = playerY;
+            targetX = newX + 0.5;
+            targetY = newY + 0.5;
+            gridX = newX;
+            gridY = newY;
+            trigger_event(newX, newY);
+        }
+    }
+}
+
+// Update movement
+void update_movement(Uint32 currentTime) {
+    if (isMoving) {
         Uint32 elapsed = currentTime - moveStartTime;
         double t = (double)elapsed / MOVE_DURATION;
 
-        if (t >= 1.0) {
-            playerX = targetX;
-            playerY = targetY;
-            isMoving = 0;
+        if (t >= 1.0) {
+            playerX = targetX;
+            playerY = targetY;
+            isMoving = 0;
+        } else {
+            playerX = startX + (targetX - startX) * t;
+            playerY = startY + (targetY - startY) * t;
+        }
+    }
+}
+
+// Update rotation
+void update_rotation(Uint32 currentTime) {
+    if (isRotating) {
+        Uint32 elapsed = currentTime - rotateStartTime;
+        double t = (double)elapsed / ROTATE_DURATION;
+
+        if (t >= 1.0) {
+            dirAngle = targetAngle;
+            isRotating = 0;
+        } else {
+            dirAngle = startAngle + (targetAngle - startAngle) * t;
+        }
+
+        // Wrap angle between 0 and 2π
+        if (dirAngle < 0) dirAngle += 2 * M_PI;
+        if (dirAngle >= 2 * M_PI) dirAngle -= 2 * M_PI;
+    }
+}
+
+// Handle raycaster input
+void handle_raycasting_input(SDL_Event event) {
+    if (event.type == SDL_KEYDOWN) {
+        Uint32 currentTime = engineTicks;
+        switch (event.key.keysym.sym) {
+            case SDLK_UP:
+                initiate_move_forward(currentTime);
+                break;
+            case SDLK_DOWN:
+                initiate_move_backward(currentTime);
+                break;
+            case SDLK_LEFT:
+                initiate_turn_left(currentTime);
+                break;
+            case SDLK_RIGHT:
+                initiate_turn_right(currentTime);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Get cached texture for the ceiling above a cell (NULL if open) from the map's ceiling layer.
+// Maps without one, like the legacy raw maps, keep their old look: half-floor cells are open to
+// the sky and every other cell repeats its floor texture overhead.
+const Uint32* ceiling_texture(int x, int y, Cell cell) {
+    if (ceilingMap) {
+        Uint8 ceiling = ceilingMap[(size_t)y * mapWidth + x];
+        return ceiling ? textureCache[(ceiling - 1) & TEXTURE_INDEX_MASK] : NULL;
+    }
+    if ((cell.tileByte & TILE_TYPE_MASK) == TILE_TYPE_HALF_FLOOR) return NULL;
+    return textureCache[get_texture_index(cell)];
+}
+
+// Per-frame raycaster parameters shared by all column bands
+typedef struct {
+    SDL_Surface* surface;
+    int width;
+    int height;
+    double dirX;
+    double dirY;
+    double planeX;
+    double planeY;
+    int fixed;              // Cast in fixed point with the values below
+    Sint32 posX;            // Player position, 16.16
+    Sint32 posY;
+    Sint32 dirXFixed;       // Direction and camera plane, 16.16
+    Sint32 dirYFixed;
+    Sint32 planeXFixed;
+    Sint32 planeYFixed;
+    Sint32 wallFalloff;     // Light falloffs, 16.16
+    Sint32 floorFalloff;
+    const struct ProjectedSprite* sprites; // Visible sprites, far to near
+    int numSprites;
+    Uint32 floorColor;      // Flat colors where no texture is drawn
+    Uint32 ceilingColor;
+} RaycastFrame;
+
+// Wall stripe rows per viewport column, drawn before the floor and ceiling fill the rest
+int wallTop[RESO_X];
+int wallBottom[RESO_X];
+
+// Fill the pixels of one row outside the wall stripes with a flat color
+void fill_flat_row(const RaycastFrame* frame, int y, int x0, int x1, Uint32 color) {
+    Uint32* row = (Uint32*)((Uint8*)frame->surface->pixels + y * frame->surface->pitch);
+    for (int x = x0; x < x1; x++) {
+        if (y >= wallTop[x] && y < wallBottom[x]) continue;
+        row[x] = color;
+        OVERDRAW_COUNT(x, y);
+    }
+}
+
+// Draw textured floor and ceiling for columns x0..x1-1, one horizontal scanline at a time. Only
+// pixels below and above the wall stripes are written, so each pixel is written once.
+void draw_floor_ceiling(const RaycastFrame* frame, int x0, int x1) {
+    const Sint64 one = (Sint64)1 << FLOOR_FRAC_BITS;
+    const Sint64 fracMask = one - 1;
+    SDL_Surface* surface = frame->surface;
+    int viewport_height = frame->height;
+
+    // Rows no floor or ceiling texture maps to keep the flat colors
+    fill_flat_row(frame, 0, x0, x1, frame->ceilingColor);
+    if (viewport_height % 2 == 0) fill_flat_row(frame, viewport_height / 2, x0, x1, frame->floorColor);
+
+    for (int y = viewport_height / 2 + 1; y < viewport_height; y++) {
+        Sint64 floorX, floorY, stepX, stepY;
+        const Uint8* light;
+
+        if (frame->fixed) {
+            // Same in integers: 16.16 row distance times 16.16 vectors gives 32.32
+            Sint64 rowDist = rowDistanceTable[y];
+            floorX = ((Sint64)frame->posX << (FLOOR_FRAC_BITS - FIXED_SHIFT)) + rowDist * (frame->dirXFixed - frame->planeXFixed);
+            floorY = ((Sint64)frame->posY << (FLOOR_FRAC_BITS - FIXED_SHIFT)) + rowDist * (frame->dirYFixed - frame->planeYFixed);
+            stepX = rowDist * 2 * frame->planeXFixed / frame->width;
+            stepY = rowDist * 2 * frame->planeYFixed / frame->width;
+            light = lightTable[light_level_fixed(rowDist, frame->floorFalloff)];
+        } else {
+            // Distance from the player to the floor seen on this row (and the mirrored ceiling row)
+            double currentDist = (double)viewport_height / (2.0 * y - viewport_height);
+
+            // Floor position under column 0, and step per column, in fixed point
+            floorX = (Sint64)((playerX + currentDist * (frame->dirX - frame->planeX)) * one);
+            floorY = (Sint64)((playerY + currentDist * (frame->dirY - frame->planeY)) * one);
+            stepX = (Sint64)(currentDist * 2.0 * frame->planeX / frame->width * one);
+            stepY = (Sint64)(currentDist * 2.0 * frame->planeY / frame->width * one);
+
+            // Whole row is at one distance, so it gets one light table
+            light = lightTable[light_level(currentDist, floorLightFalloff)];
+        }
+
+        // Integer stepping lands on exactly the same position for any band start
+        floorX += stepX * x0;
+        floorY += stepY * x0;
+
+        int ceilingY = viewport_height - y;
+        Uint32* floorRow = (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+        Uint32* ceilingRow = (Uint32*)((Uint8*)surface->pixels + ceilingY * surface->pitch);
+        Uint32 ceilingFlat = ceilingY < viewport_height / 2 ? frame->ceilingColor : frame->floorColor;
+
+        // Mip level of the row, the ceiling row mirrors it
+        int level = rowMipLevel[y];
+        int size = TILE_SIZE >> level;
+
+        // Textures are looked up again only when the row crosses into another cell
+        int cellX = -1;
+        int cellY = -1;
+        int inBounds = 0;
+        const Uint32* floorTexture = NULL;
+        const Uint32* ceilingTexture = NULL;
+
+        for (int x = x0; x < x1; x++, floorX += stepX, floorY += stepY) {
+            int drawFloor = y >= wallBottom[x];
+            int drawCeiling = ceilingY < wallTop[x];
+            if (!drawFloor && !drawCeiling) continue;
+
+            int mapX = (int)(floorX >> FLOOR_FRAC_BITS);
+            int mapY = (int)(floorY >> FLOOR_FRAC_BITS);
+            if (mapX != cellX || mapY != cellY) {
+                cellX = mapX;
+                cellY = mapY;
+                inBounds = in_map(mapX, mapY);
+                if (inBounds) {
+                    Cell cell = get_cell(mapX, mapY);
+                    floorTexture = textureCache[get_texture_index(cell)] + mipOffset[level];
+                    ceilingTexture = ceiling_texture(mapX, mapY, cell);
+                    if (ceilingTexture) ceilingTexture += mipOffset[level];
+                }
+            }
+
+            // Calculate texture coordinates, out of bounds gets the flat colors
+            int texX = (int)(((floorX & fracMask) * size) >> FLOOR_FRAC_BITS);
+            int texY = (int)(((floorY & fracMask) * size) >> FLOOR_FRAC_BITS);
+            int texel = texX * size + texY;
+
+            if (drawFloor) {
+                floorRow[x] = inBounds ? shade_pixel(floorTexture[texel], light) : frame->floorColor;
+                OVERDRAW_COUNT(x, y);
+            }
+            if (drawCeiling) {
+                ceilingRow[x] = inBounds && ceilingTexture ? shade_pixel(ceilingTexture[texel], light) : ceilingFlat;
+                OVERDRAW_COUNT(x, ceilingY);
+            }
+        }
+    }
+}
+
+// Result of casting one column's ray
+typedef struct {
+    double perpWallDist; // Distance to the wall along the view direction
+    int mapX;            // Map cell that was hit
+    int mapY;
+    int side;            // 0 = NS wall, 1 = EW wall
+    int lineHeight;      // Height of the wall stripe on screen
+    int texX;            // Texture column
+} RayHit;
+
+// Check if a ray stops at a map cell (walls, half tiles and out of bounds)
+int ray_blocked(int mapX, int mapY) {
+    if (in_map(mapX, mapY)) {
+        return get_tile_type(get_cell(mapX, mapY)) > 0;
+    }
+    return 1;
+}
+
+// Move a ray from a cell in an open block to the first cell outside it in one jump,
+// arriving at the same cell and side as stepping the DDA cell by cell. The sideDists are
+// summed one deltaDist at a time like the stepped DDA, so they round the same way: the jump
+// saves the map and mask lookups of every cell, but still costs one addition per cell
+// crossed rather than O(1). A multiply would be O(1) but can land one ulp off the stepped
+// sums and change which side a ray hits.
+void skip_open_block(int* mapX, int* mapY, double* sideDistX, double* sideDistY,
+                     double deltaDistX, double deltaDistY, int stepX, int stepY, int* side) {
+    // Steps needed to leave the block along each axis, and the sideDist of that last step
+    int stepsX = stepX > 0 ? BLOCK_SIZE - (*mapX & BLOCK_MASK) : (*mapX & BLOCK_MASK) + 1;
+    int stepsY = stepY > 0 ? BLOCK_SIZE - (*mapY & BLOCK_MASK) : (*mapY & BLOCK_MASK) + 1;
+    double exitDistX = *sideDistX;
+    for (int i = 1; i < stepsX; i++) exitDistX += deltaDistX;
+    double exitDistY = *sideDistY;
+    for (int i = 1; i < stepsY; i++) exitDistY += deltaDistY;
+
+    if (exitDistX < exitDistY) {
+        // Leaves through an x-side, after the y-steps the DDA would take first (ties go to y)
+        int n = 0;
+        double distY = *sideDistY;
+        while (n < stepsY - 1 && distY <= exitDistX) {
+            distY += deltaDistY;
+            n++;
+        }
+        *mapX += stepsX * stepX;
+        *sideDistX = exitDistX + deltaDistX;
+        *mapY += n * stepY;
+        *sideDistY = distY;
+        *side = 0;
+    } else {
+        // Leaves through a y-side
+        int n = 0;
+        double distX = *sideDistX;
+        while (n < stepsX - 1 && distX < exitDistY) {
+            distX += deltaDistX;
+            n++;
+        }
+        *mapY += stepsY * stepY;
+        *sideDistY = exitDistY + deltaDistY;
+        *mapX += n * stepX;
+        *sideDistX = distX;
+        *side = 1;
+    }
+}
+
+// Cast the ray for column x
+void cast_ray(const RaycastFrame* frame, int x, RayHit* hit) {
+    int viewport_width = frame->width;
+    int viewport_height = frame->height;
+
+    // Calculate ray position and direction
+    double rayCameraX = 2 * x / (double)viewport_width - 1; // x-coordinate in camera space
+    double rayDirX = frame->dirX + frame->planeX * rayCameraX;
+    double rayDirY = frame->dirY + frame->planeY * rayCameraX;
+
+    // Map position
+    int mapX = (int)playerX;
+    int mapY = (int)playerY;
+
+    // Length of ray from current position to next x or y-side
+    double sideDistX;
+    double sideDistY;
+
+    // Length of ray from one x or y-side to next x or y-side
+    double deltaDistX = (rayDirX == 0) ? 1e30 : fabs(1 / rayDirX);
+    double deltaDistY = (rayDirY == 0) ? 1e30 : fabs(1 / rayDirY);
+    double perpWallDist;
+
+    // Direction to go in x and y (+1 or -1)
+    int stepX;
+    int stepY;
+
+    int side = 0; // Was a NS or a EW wall hit?
+
+    // Calculate step and initial sideDist
+    if (rayDirX < 0) {
+        stepX = -1;
+        sideDistX = (playerX - mapX) * deltaDistX;
+    } else {
+        stepX = 1;
+        sideDistX = (mapX + 1.0 - playerX) * deltaDistX;
+    }
+    if (rayDirY < 0) {
+        stepY = -1;
+        sideDistY = (playerY - mapY) * deltaDistY;
+    } else {
+        stepY = 1;
+        sideDistY = (mapY + 1.0 - playerY) * deltaDistY;
+    }
+
+    // Perform DDA, crossing open blocks in one jump
+    do {
+        // Jump to next map square in x or y direction
+        if (block_open(mapX, mapY)) {
+            skip_open_block(&mapX, &mapY, &sideDistX, &sideDistY, deltaDistX, deltaDistY, stepX, stepY, &side);
+        } else if (sideDistX < sideDistY) {
+            sideDistX += deltaDistX;
+            mapX += stepX;
+            side = 0; // NS wall
+        } else {
+            sideDistY += deltaDistY;
+            mapY += stepY;
+            side = 1; // EW wall
+        }
+    } while (!cell_maybe_solid(mapX, mapY) || !ray_blocked(mapX, mapY));
+
+    // Avoid fish-eye
+    if (side == 0) {
+        perpWallDist = (mapX - playerX + (1 - stepX) / 2) / rayDirX;
+    } else {
+        perpWallDist = (mapY - playerY + (1 - stepY) / 2) / rayDirY;
+    }
+
+    // Calculate texture X coordinate for wall hit
+    double wallX;
+    if (side == 0) {
+        wallX = playerY + perpWallDist * rayDirY;
+    } else {
+        wallX = playerX + perpWallDist * rayDirX;
+    }
+    wallX -= floor(wallX);
+
+    int texX = (int)(wallX * (double)TILE_SIZE);
+    if (side == 0 && rayDirX > 0) texX = TILE_SIZE - texX - 1;
+    if (side == 1 && rayDirY < 0) texX = TILE_SIZE - texX - 1;
+
+    hit->perpWallDist = perpWallDist;
+    hit->mapX = mapX;
+    hit->mapY = mapY;
+    hit->side = side;
+    hit->lineHeight = (int)(viewport_height / perpWallDist); // Height of line for screen
+    hit->texX = texX;
+}
+
+// Cast RAY_PACKET adjacent columns starting at x, one at a time
+void cast_packet_scalar(const RaycastFrame* frame, int x, RayHit* hits) {
+    for (int i = 0; i < RAY_PACKET; i++) {
+        cast_ray(frame, x + i, &hits[i]);
+    }
+}
+
+// Integer version of skip_open_block() for 16.16 rays, exact like the stepped DDA
+void skip_open_block_fixed(int* mapX, int* mapY, Sint64* sideDistX, Sint64* sideDistY,
+                           Sint64 deltaDistX, Sint64 deltaDistY, int stepX, int stepY, int* side) {
+    int stepsX = stepX > 0 ? BLOCK_SIZE - (*mapX & BLOCK_MASK) : (*mapX & BLOCK_MASK) + 1;
+    int stepsY = stepY > 0 ? BLOCK_SIZE - (*mapY & BLOCK_MASK) : (*mapY & BLOCK_MASK) + 1;
+    Sint64 exitDistX = *sideDistX + (stepsX - 1) * deltaDistX;
+    Sint64 exitDistY = *sideDistY + (stepsY - 1) * deltaDistY;
+
+    if (exitDistX < exitDistY) {
+        int n = 0;
+        while (n < stepsY - 1 && *sideDistY + n * deltaDistY <= exitDistX) n++;
+        *mapX += stepsX * stepX;
+        *sideDistX = exitDistX + deltaDistX;
+        *mapY += n * stepY;
+        *sideDistY += n * deltaDistY;
+        *side = 0;
+    } else {
+        int n = 0;
+        while (n < stepsX - 1 && *sideDistX + n * deltaDistX < exitDistY) n++;
+        *mapY += stepsY * stepY;
+        *sideDistY = exitDistY + deltaDistY;
+        *mapX += n * stepX;
+        *sideDistX += n * deltaDistX;
+        *side = 1;
+    }
+}
+
+// Cast the ray for column x in 16.16 fixed point
+void cast_ray_fixed(const RaycastFrame* frame, int x, RayHit* hit) {
+    // Ray direction
+    Sint64 rayCameraX = ((Sint64)2 * x << FIXED_SHIFT) / frame->width - FIXED_ONE;
+    Sint64 rayDirX = frame->dirXFixed + ((frame->planeXFixed * rayCameraX) >> FIXED_SHIFT);
+    Sint64 rayDirY = frame->dirYFixed + ((frame->planeYFixed * rayCameraX) >> FIXED_SHIFT);
+
+    // Reciprocals for the distance between x and y sides
+    Sint64 deltaDistX = rayDirX == 0 ? FIXED_MAX_DELTA : ((Sint64)1 << (2 * FIXED_SHIFT)) / (rayDirX < 0 ? -rayDirX : rayDirX);
+    Sint64 deltaDistY = rayDirY == 0 ? FIXED_MAX_DELTA : ((Sint64)1 << (2 * FIXED_SHIFT)) / (rayDirY < 0 ? -rayDirY : rayDirY);
+    if (deltaDistX > FIXED_MAX_DELTA) deltaDistX = FIXED_MAX_DELTA;
+    if (deltaDistY > FIXED_MAX_DELTA) deltaDistY = FIXED_MAX_DELTA;
+
+    int mapX = frame->posX >> FIXED_SHIFT;
+    int mapY = frame->posY >> FIXED_SHIFT;
+    Sint64 fracX = frame->posX & (FIXED_ONE - 1);
+    Sint64 fracY = frame->posY & (FIXED_ONE - 1);
+
+    int stepX = rayDirX < 0 ? -1 : 1;
+    int stepY = rayDirY < 0 ? -1 : 1;
+    Sint64 sideDistX = ((rayDirX < 0 ? fracX : FIXED_ONE - fracX) * deltaDistX) >> FIXED_SHIFT;
+    Sint64 sideDistY = ((rayDirY < 0 ? fracY : FIXED_ONE - fracY) * deltaDistY) >> FIXED_SHIFT;
+    int side = 0;
+
+    // Integer DDA, crossing open blocks in one jump
+    do {
+        if (block_open(mapX, mapY)) {
+            skip_open_block_fixed(&mapX, &mapY, &sideDistX, &sideDistY, deltaDistX, deltaDistY, stepX, stepY, &side);
+        } else if (sideDistX < sideDistY) {
+            sideDistX += deltaDistX;
+            mapX += stepX;
+            side = 0;
+        } else {
+            sideDistY += deltaDistY;
+            mapY += stepY;
+            side = 1;
+        }
+    } while (!cell_maybe_solid(mapX, mapY) || !ray_blocked(mapX, mapY));
+
+    // Perpendicular distance is the side distance before the last step
+    Sint64 perpWallDist = side == 0 ? sideDistX - deltaDistX : sideDistY - deltaDistY;
+    if (perpWallDist < 1) perpWallDist = 1;
+
+    // Texture X from the fractional part of the hit position
+    Sint64 wallX = side == 0 ? frame->posY + ((perpWallDist * rayDirY) >> FIXED_SHIFT)
+                             : frame->posX + ((perpWallDist * rayDirX) >> FIXED_SHIFT);
+    int texX = (int)(((wallX & (FIXED_ONE - 1)) * TILE_SIZE) >> FIXED_SHIFT);
+    if (side == 0 && rayDirX > 0) texX = TILE_SIZE - texX - 1;
+    if (side == 1 && rayDirY < 0) texX = TILE_SIZE - texX - 1;
+
+    hit->perpWallDist = (double)perpWallDist / FIXED_ONE; // Exact, for the z-buffer and sprites
+    hit->mapX = mapX;
+    hit->mapY = mapY;
+    hit->side = side;
+    hit->lineHeight = (int)(((Sint64)frame->height << FIXED_SHIFT) / perpWallDist);
+    hit->texX = texX;
+}
+
+// Cast RAY_PACKET adjacent columns starting at x in fixed point
+void cast_packet_fixed(const RaycastFrame* frame, int x, RayHit* hits) {
+    for (int i = 0; i < RAY_PACKET; i++) {
+        cast_ray_fixed(frame, x + i, &hits[i]);
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_RAY_SIMD 1
+
+// Packet lanes: RAY_PACKET doubles and matching 64-bit integers/masks
+typedef double RayLanes __attribute__((vector_size(RAY_PACKET * sizeof(double))));
+typedef long long RayMask __attribute__((vector_size(RAY_PACKET * sizeof(long long))));
+
+// Pick a where mask is set, b elsewhere
+#define LANE_SELECT(mask, a, b) ((RayLanes)(((RayMask)(a) & (mask)) | ((RayMask)(b) & ~(mask))))
+
+// Cast RAY_PACKET adjacent columns in lanes. Every lane does the same IEEE operations
+// as cast_ray(), so results are bit-identical to the scalar path.
+static inline __attribute__((always_inline)) void cast_packet_lanes(const RaycastFrame* frame, int x, RayHit* hits) {
+    RayLanes column;
+    for (int i = 0; i < RAY_PACKET; i++) column[i] = 2 * (x + i);
+
+    // Ray direction per lane
+    RayLanes rayCameraX = column / (double)frame->width - 1.0;
+    RayLanes rayDirX = frame->dirX + frame->planeX * rayCameraX;
+    RayLanes rayDirY = frame->dirY + frame->planeY * rayCameraX;
+
+    int originX = (int)playerX;
+    int originY = (int)playerY;
+    RayMask mapX = originX - (RayMask){0};
+    RayMask mapY = originY - (RayMask){0};
+
+    // deltaDist = |1 / rayDir|, or 1e30 for axis-aligned rays
+    RayLanes inverseX = 1.0 / rayDirX;
+    RayLanes inverseY = 1.0 / rayDirY;
+    RayLanes deltaDistX = LANE_SELECT(rayDirX == 0, 1e30 - (RayLanes){0}, LANE_SELECT(inverseX < 0, -inverseX, inverseX));
+    RayLanes deltaDistY = LANE_SELECT(rayDirY == 0, 1e30 - (RayLanes){0}, LANE_SELECT(inverseY < 0, -inverseY, inverseY));
+
+    // Step direction and initial sideDist
+    RayMask negativeX = rayDirX < 0;
+    RayMask negativeY = rayDirY < 0;
+    RayMask stepX = negativeX | 1;
+    RayMask stepY = negativeY | 1;
+    RayLanes sideDistX = LANE_SELECT(negativeX, (playerX - originX) * deltaDistX, (originX + 1.0 - playerX) * deltaDistX);
+    RayLanes sideDistY = LANE_SELECT(negativeY, (playerY - originY) * deltaDistY, (originY + 1.0 - playerY) * deltaDistY);
+
+    // DDA: lanes step together, finished lanes are masked off and lanes in open blocks jump alone
+    RayMask active = ~(RayMask){0};
+    RayMask side = (RayMask){0};
+    int remaining = RAY_PACKET;
+    while (remaining > 0) {
+        RayMask stepping = active;
+        for (int i = 0; i < RAY_PACKET; i++) {
+            if (active[i] && block_open((int)mapX[i], (int)mapY[i])) {
+                int laneMapX = (int)mapX[i], laneMapY = (int)mapY[i], laneSide;
+                double laneSideDistX = sideDistX[i], laneSideDistY = sideDistY[i];
+                skip_open_block(&laneMapX, &laneMapY, &laneSideDistX, &laneSideDistY,
+                                deltaDistX[i], deltaDistY[i], (int)stepX[i], (int)stepY[i], &laneSide);
+                mapX[i] = laneMapX;
+                mapY[i] = laneMapY;
+                sideDistX[i] = laneSideDistX;
+                sideDistY[i] = laneSideDistY;
+                side[i] = laneSide;
+                stepping[i] = 0;
+            }
+        }
+
+        RayMask takeX = (sideDistX < sideDistY) & stepping;
+        RayMask takeY = ~(sideDistX < sideDistY) & stepping;
+
+        sideDistX = LANE_SELECT(takeX, sideDistX + deltaDistX, sideDistX);
+        sideDistY = LANE_SELECT(takeY, sideDistY + deltaDistY, sideDistY);
+        mapX += stepX & takeX;
+        mapY += stepY & takeY;
+        side = (side & ~stepping) | (takeY & 1);
+
+        for (int i = 0; i < RAY_PACKET; i++) {
+            if (active[i] && cell_maybe_solid((int)mapX[i], (int)mapY[i]) && ray_blocked((int)mapX[i], (int)mapY[i])) {
+                active[i] = 0;
+                remaining--;
+            }
+        }
+    }
+
+    // Perpendicular distance per lane (avoid fish-eye)
+    RayMask sideY = -side;
+    RayLanes perpX = (__builtin_convertvector(mapX, RayLanes) - playerX + __builtin_convertvector((1 - stepX) / 2, RayLanes)) / rayDirX;
+    RayLanes perpY = (__builtin_convertvector(mapY, RayLanes) - playerY + __builtin_convertvector((1 - stepY) / 2, RayLanes)) / rayDirY;
+    RayLanes perpWallDist = LANE_SELECT(sideY, perpY, perpX);
+
+    // Line height, truncated like the scalar (int) cast
+    RayMask lineHeight = __builtin_convertvector(frame->height / perpWallDist, RayMask);
+
+    // Texture X: fractional part of the wall hit position
+    RayLanes wallX = LANE_SELECT(sideY, playerX + perpWallDist * rayDirX, playerY + perpWallDist * rayDirY);
+    RayLanes wallFloor = __builtin_convertvector(__builtin_convertvector(wallX, RayMask), RayLanes);
+    wallFloor = LANE_SELECT(wallFloor > wallX, wallFloor - 1.0, wallFloor);
+    wallX -= wallFloor;
+
+    RayMask texX = __builtin_convertvector(wallX * (double)TILE_SIZE, RayMask);
+    RayMask flip = (~sideY & (rayDirX > 0)) | (sideY & (rayDirY < 0));
+    texX = (flip & (TILE_SIZE - texX - 1)) | (~flip & texX);
+
+    for (int i = 0; i < RAY_PACKET; i++) {
+        hits[i].perpWallDist = perpWallDist[i];
+        hits[i].mapX = (int)mapX[i];
+        hits[i].mapY = (int)mapY[i];
+        hits[i].side = (int)side[i];
+        hits[i].lineHeight = (int)lineHeight[i];
+        hits[i].texX = (int)texX[i];
+    }
+}
+
+// Packet caster compiled for AVX2 (4 doubles per register)
+__attribute__((target("avx2"))) void cast_packet_avx2(const RaycastFrame* frame, int x, RayHit* hits) {
+    cast_packet_lanes(frame, x, hits);
+}
+
+// Packet caster compiled for SSE2 (2 doubles per register)
+__attribute__((target("sse2"))) void cast_packet_sse2(const RaycastFrame* frame, int x, RayHit* hits) {
+    cast_packet_lanes(frame, x, hits);
+}
+#endif
+
+// Packet caster in use (picked at runtime by select_ray_caster)
+void (*cast_packet)(const RaycastFrame* frame, int x, RayHit* hits) = NULL;
+const char* rayCasterName = "scalar";
+
+// Pick the fastest packet caster this CPU supports
+void select_ray_caster(void) {
+    cast_packet = cast_packet_scalar;
+    rayCasterName = "scalar";
+
+    if (rayFixed) {
+        cast_packet = cast_packet_fixed;
+        rayCasterName = "fixed";
+        return;
+    }
+
+#ifdef HAVE_RAY_SIMD
+    if (raySimd) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            cast_packet = cast_packet_avx2;
+            rayCasterName = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            cast_packet = cast_packet_sse2;
+            rayCasterName = "sse2";
+        }
+    }
+#endif
+}
+
+// Draw the wall stripe for column x
+void draw_wall_stripe(const RaycastFrame* frame, int x, const RayHit* hit) {
+    SDL_Surface* surface = frame->surface;
+    int viewport_height = frame->height;
+    int lineHeight = hit->lineHeight;
+
+    // Calculate lowest and highest pixel to fill in current stripe
+    int drawStart = -lineHeight / 2 + viewport_height / 2;
+    if (drawStart < 0) drawStart = 0;
+    int drawEnd = lineHeight / 2 + viewport_height / 2;
+    if (drawEnd >= viewport_height) drawEnd = viewport_height - 1;
+    if (drawEnd < drawStart) drawEnd = drawStart;
+    wallTop[x] = drawStart;
+    wallBottom[x] = drawEnd;
+
+    // First pixel of the stripe
+    Uint8* dst = (Uint8*)surface->pixels + drawStart * surface->pitch + x * sizeof(Uint32);
+
+    // Get cell data
+    if (!in_map(hit->mapX, hit->mapY)) {
+        // Default color if out of bounds
+        Uint32 white = SDL_MapRGB(surface->format, 255, 255, 255);
+        for (int y = drawStart; y < drawEnd; y++, dst += surface->pitch) {
+            *(Uint32*)dst = white;
+            OVERDRAW_COUNT(x, y);
+        }
+        return;
+    }
+
+    Cell cell = get_cell(hit->mapX, hit->mapY);
+    uint8_t textureIndex = get_texture_index(cell);
+
+    // Texture column at the stripe's mip level, and light table for this stripe
+    int level = wall_mip_level(lineHeight);
+    int size = TILE_SIZE >> level;
+    const Uint32* texColumn = textureCache[textureIndex] + mipOffset[level] + (hit->texX >> level) * size;
+    int lightLevel = frame->fixed ? light_level_fixed((Sint64)(hit->perpWallDist * FIXED_ONE), frame->wallFalloff)
+                                  : light_level(hit->perpWallDist, wallLightFalloff);
+    const Uint8* wallLight = lightTable[lightLevel];
+
+    // Draw texture stripe
+    for (int y = drawStart; y < drawEnd; y++, dst += surface->pitch) {
+        int d = y * 256 - viewport_height * 128 + lineHeight * 128;
+        int texY = ((d * size) / lineHeight) / 256;
+
+        // Clamp texY to texture bounds
+        if (texY < 0) texY = 0;
+        if (texY >= size) texY = size - 1;
+
+        // Get pixel from texture cache and apply column shading
+        *(Uint32*)dst = shade_pixel(texColumn[texY], wallLight);
+        OVERDRAW_COUNT(x, y);
+    }
+}
+
+// Wall distance per viewport column, for sprite occlusion
+double zBuffer[RESO_X];
+
+// Cast rays and draw wall stripes for columns x0..x1-1
+void draw_walls(const RaycastFrame* frame, int x0, int x1) {
+    PHASE_START(phaseClock);
+    RayHit hits[RAY_PACKET];
+
+    for (int x = x0; x < x1; x += RAY_PACKET) {
+        int count = x1 - x;
+        if (count >= RAY_PACKET) {
+            count = RAY_PACKET;
+            cast_packet(frame, x, hits);
+        } else {
+            for (int i = 0; i < count; i++) {
+                if (frame->fixed) {
+                    cast_ray_fixed(frame, x + i, &hits[i]);
+                } else {
+                    cast_ray(frame, x + i, &hits[i]);
+                }
+            }
+        }
+        PHASE_MARK(phaseClock, PHASE_DDA);
+
+        for (int i = 0; i < count; i++) {
+            draw_wall_stripe(frame, x + i, &hits[i]);
+            zBuffer[x + i] = hits[i].perpWallDist;
+        }
+        PHASE_MARK(phaseClock, PHASE_WALL);
+    }
+}
+
+// Billboard sprite in the world
+typedef struct {
+    double x;
+    double y;
+    int texture; // Texture cache index, texels with alpha < 128 are transparent
+} Sprite;
+
+Sprite sprites[MAX_SPRITES];
+int numSprites = 0;
+
+// Add a sprite, returns its index or -1 if full
+int add_sprite(double x, double y, int texture) {
+    if (numSprites >= MAX_SPRITES) return -1;
+    sprites[numSprites].x = x;
+    sprites[numSprites].y = y;
+    sprites[numSprites].texture = texture & TEXTURE_INDEX_MASK;
+    mark_dirty(REGION_VIEWPORT);
+    return numSprites++;
+}
+
+// Remove all sprites
+void clear_sprites(void) {
+    numSprites = 0;
+    mark_dirty(REGION_VIEWPORT);
+}
+
+// Sprite projected onto the screen for the current frame
+typedef struct ProjectedSprite {
+    double depth;        // Distance along the view direction
+    int screenX;         // Screen column of the sprite center
+    int size;            // Width and height on screen
+    int x0;              // First visible column
+    int x1;              // One past the last visible column
+    int texture;
+    const Uint8* light;
+} ProjectedSprite;
+
+ProjectedSprite visibleSprites[MAX_SPRITES];
+
+// Sort helper: far sprites first
+int compare_sprite_depth(const void* a, const void* b) {
+    double da = ((const ProjectedSprite*)a)->depth;
+    double db = ((const ProjectedSprite*)b)->depth;
+    return (da < db) - (da > db);
+}
+
+// Project sprites in front of the camera and sort them far to near
+int project_sprites(const RaycastFrame* frame) {
+    double invDet = 1.0 / (frame->planeX * frame->dirY - frame->dirX * frame->planeY);
+    int count = 0;
+
+    for (int i = 0; i < numSprites; i++) {
+        double spriteX = sprites[i].x - playerX;
+        double spriteY = sprites[i].y - playerY;
+
+        // Camera space: transformX across the view, depth along it
+        double transformX = invDet * (frame->dirY * spriteX - frame->dirX * spriteY);
+        double depth = invDet * (-frame->planeY * spriteX + frame->planeX * spriteY);
+        if (depth <= 0.1) continue; // Behind or at the camera
+
+        int screenX = (int)((frame->width / 2) * (1 + transformX / depth));
+        int size = (int)(frame->height / depth);
+        int width = (int)(frame->width / (2 * FOV_FACTOR * depth));
+
+        int x0 = screenX - width / 2;
+        int x1 = screenX + width / 2;
+        if (x0 < 0) x0 = 0;
+        if (x1 > frame->width) x1 = frame->width;
+        if (x0 >= x1) continue; // Off screen
+
+        ProjectedSprite* p = &visibleSprites[count++];
+        p->depth = depth;
+        p->screenX = screenX;
+        p->size = size;
+        p->x0 = x0;
+        p->x1 = x1;
+        p->texture = sprites[i].texture;
+        p->light = lightTable[light_level(depth, wallLightFalloff)];
+    }
+
+    qsort(visibleSprites, count, sizeof(ProjectedSprite), compare_sprite_depth);
+    return count;
+}
+
+// Draw visible sprites over columns x0..x1-1, clipped against the wall z-buffer
+void draw_sprites(const RaycastFrame* frame, int x0, int x1) {
+    if (frame->numSprites == 0) return;
+
+    SDL_Surface* surface = frame->surface;
+    int viewport_width = frame->width;
+    int viewport_height = frame->height;
+
+    // Farthest wall in this band: sprites behind it are hidden in every column
+    double farthestWall = 0.0;
+    for (int x = x0; x < x1; x++) {
+        if (zBuffer[x] > farthestWall) farthestWall = zBuffer[x];
+    }
+
+    for (int i = 0; i < frame->numSprites; i++) {
+        const ProjectedSprite* sprite = &frame->sprites[i];
+        if (sprite->depth >= farthestWall) continue;
+
+        // Clip to this band, then trim occluded columns from both ends
+        int start = sprite->x0 > x0 ? sprite->x0 : x0;
+        int end = sprite->x1 < x1 ? sprite->x1 : x1;
+        while (start < end && zBuffer[start] <= sprite->depth) start++;
+        while (start < end && zBuffer[end - 1] <= sprite->depth) end--;
+        if (start >= end) continue;
+
+        int size = sprite->size;
+        int width = (int)(viewport_width / (2 * FOV_FACTOR * sprite->depth));
+        int left = sprite->screenX - width / 2;
+        int drawStart = -size / 2 + viewport_height / 2;
+        if (drawStart < 0) drawStart = 0;
+        int drawEnd = size / 2 + viewport_height / 2;
+        if (drawEnd >= viewport_height) drawEnd = viewport_height - 1;
+
+        const Uint32* texture = textureCache[sprite->texture];
+        const Uint32* opaque = textureOpaque[sprite->texture];
+
+        for (int x = start; x < end; x++) {
+            if (zBuffer[x] <= sprite->depth) continue; // Wall in front in this column
+
+            int texX = (x - left) * TILE_SIZE / width;
+            if (texX < 0) texX = 0;
+            if (texX >= TILE_SIZE) texX = TILE_SIZE - 1;
+
+            Uint32 columnMask = opaque[texX];
+            if (!columnMask) continue;
+            const Uint32* texColumn = texture + texX * TILE_SIZE;
+
+            Uint8* dst = (Uint8*)surface->pixels + drawStart * surface->pitch + x * sizeof(Uint32);
+            for (int y = drawStart; y < drawEnd; y++, dst += surface->pitch) {
+                int d = y * 256 - viewport_height * 128 + size * 128;
+                int texY = ((d * TILE_SIZE) / size) / 256;
+                if (texY < 0) texY = 0;
+                if (texY >= TILE_SIZE) texY = TILE_SIZE - 1;
+
+                if (columnMask & ((Uint32)1 << texY)) {
+                    *(Uint32*)dst = shade_pixel(texColumn[texY], sprite->light);
+                    OVERDRAW_COUNT(x, y);
+                }
+            }
+        }
+    }
+}
+
+// Render walls, floor and ceiling for columns x0..x1-1. Walls go first so the floor and ceiling
+// only fill the rows around them.
+void render_band(const RaycastFrame* frame, int x0, int x1) {
+    draw_walls(frame, x0, x1);
+    PHASE_START(phaseClock);
+    draw_floor_ceiling(frame, x0, x1);
+    PHASE_MARK(phaseClock, PHASE_FLOOR);
+    draw_sprites(frame, x0, x1);
+    PHASE_MARK(phaseClock, PHASE_SPRITE);
+    PHASE_FLUSH();
+}
+
+// Persistent pool of raycaster worker threads
+typedef struct {
+    SDL_Thread* threads[MAX_RENDER_THREADS];
+    int numThreads;           // Workers running
+    int requested;            // Workers asked for, more than numThreads if some failed to start
+    SDL_mutex* lock;
+    SDL_cond* workReady;      // Signalled when a frame is posted
+    SDL_cond* workDone;       // Signalled when the last band of a frame is finished
+    unsigned int frameId;     // Incremented for every posted frame
+    const RaycastFrame* frame;
+    int bandWidth;
+    int nextBand;             // Next band to claim
+    int numBands;
+    int bandsLeft;            // Bands not finished yet
+    int quit;
+} RenderPool;
+
+RenderPool renderPool;
+
+// Claim and render bands until none are left (called with the pool lock held)
+void render_pool_work(void) {
+    while (renderPool.nextBand < renderPool.numBands) {
+        const RaycastFrame* frame = renderPool.frame;
+        int x0 = renderPool.nextBand++ * renderPool.bandWidth;
+        int x1 = x0 + renderPool.bandWidth;
+        if (x1 > frame->width) x1 = frame->width;
+
+        SDL_UnlockMutex(renderPool.lock);
+        render_band(frame, x0, x1);
+        SDL_LockMutex(renderPool.lock);
+
+        if (--renderPool.bandsLeft == 0) {
+            SDL_CondSignal(renderPool.workDone);
+        }
+    }
+}
+
+// Worker thread: wait for a frame, help render it, repeat
+int render_worker(void* data) {
+    unsigned int seenFrame = 0;
+    (void)data;
+
+    SDL_LockMutex(renderPool.lock);
+    while (1) {
+        while (!renderPool.quit && renderPool.frameId == seenFrame) {
+            SDL_CondWait(renderPool.workReady, renderPool.lock);
+        }
+        if (renderPool.quit) break;
+
+        seenFrame = renderPool.frameId;
+        render_pool_work();
+    }
+    SDL_UnlockMutex(renderPool.lock);
+    return 0;
+}
+
+// Start worker threads (the calling thread renders bands too)
+void render_pool_start(int workers) {
+    renderPool.lock = SDL_CreateMutex();
+    renderPool.workReady = SDL_CreateCond();
+    renderPool.workDone = SDL_CreateCond();
+    renderPool.quit = 0;
+    renderPool.numThreads = 0;
+    renderPool.requested = workers;
+
+    for (int i = 0; i < workers; i++) {
+        SDL_Thread* thread = SDL_CreateThread(render_worker, NULL);
+        if (!thread) {
+            printf("Unable to create render thread: %s\n", SDL_GetError());
+            break;
+        }
+        renderPool.threads[renderPool.numThreads++] = thread;
+    }
+}
+
+// Stop and join worker threads
+void render_pool_stop(void) {
+    if (!renderPool.lock) return;
+
+    SDL_LockMutex(renderPool.lock);
+    renderPool.quit = 1;
+    SDL_CondBroadcast(renderPool.workReady);
+    SDL_UnlockMutex(renderPool.lock);
+
+    for (int i = 0; i < renderPool.numThreads; i++) {
+        SDL_WaitThread(renderPool.threads[i], NULL);
+    }
+
+    SDL_DestroyCond(renderPool.workReady);
+    SDL_DestroyCond(renderPool.workDone);
+    SDL_DestroyMutex(renderPool.lock);
+    memset(&renderPool, 0, sizeof(renderPool));
+}
+
+// Render a frame in bands across the pool and wait until every band is done
+void render_pool_run(const RaycastFrame* frame, int bandWidth) {
+    SDL_LockMutex(renderPool.lock);
+    renderPool.frame = frame;
+    renderPool.bandWidth = bandWidth;
+    renderPool.nextBand = 0;
+    renderPool.numBands = (frame->width + bandWidth - 1) / bandWidth;
+    renderPool.bandsLeft = renderPool.numBands;
+    renderPool.frameId++;
+    SDL_CondBroadcast(renderPool.workReady);
+
+    render_pool_work();
+
+    // Barrier: the frame is complete once all bands are finished
+    while (renderPool.bandsLeft > 0) {
+        SDL_CondWait(renderPool.workDone, renderPool.lock);
+    }
+    SDL_UnlockMutex(renderPool.lock);
+}
+
+// Get number of threads to render with
+int render_thread_count(void) {
+    int threads = renderThreads;
+    if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+        threads = 1;
+#endif
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_RENDER_THREADS) threads = MAX_RENDER_THREADS;
+    return threads;
+}
+
+// Raycaster
+void raycaster(SDL_Surface* surface, int viewport_width, int viewport_height) {
+    // Every pixel is written once by the bands, there is nothing to clear
+    OVERDRAW_BEGIN(viewport_width, viewport_height);
+
+    // Texels are sampled from the cache, already in the surface format
+    ensure_texture_cache(surface->format);
+    if (!cast_packet) select_ray_caster();
+
+    // Calculate direction vector and camera plane based on dirAngle
+    RaycastFrame frame;
+    frame.surface = surface;
+    frame.width = viewport_width;
+    frame.height = viewport_height;
+    frame.fixed = rayFixed;
+    frame.floorColor = SDL_MapRGB(surface->format, 50, 50, 50);
+    frame.ceilingColor = SDL_MapRGB(surface->format, 20, 20, 20);
+    if (frame.fixed) {
+        // Fixed point: table trig, and the same quantised camera for sprites
+        if (!sinTableValid) build_sin_table();
+        if (rowDistanceHeight != viewport_height) build_row_distances(viewport_height);
+        int angle = trig_index(dirAngle);
+        frame.posX = (Sint32)floor(playerX * FIXED_ONE);
+        frame.posY = (Sint32)floor(playerY * FIXED_ONE);
+        frame.dirXFixed = sinTable[(angle + TRIG_STEPS / 4) & (TRIG_STEPS - 1)];
+        frame.dirYFixed = sinTable[angle];
+        frame.planeXFixed = (Sint32)(-(Sint64)frame.dirYFixed * (Sint64)(FOV_FACTOR * FIXED_ONE) / FIXED_ONE);
+        frame.planeYFixed = (Sint32)((Sint64)frame.dirXFixed * (Sint64)(FOV_FACTOR * FIXED_ONE) / FIXED_ONE);
+        frame.wallFalloff = (Sint32)floor(wallLightFalloff * FIXED_ONE + 0.5);
+        frame.floorFalloff = (Sint32)floor(floorLightFalloff * FIXED_ONE + 0.5);
+        frame.dirX = (double)frame.dirXFixed / FIXED_ONE;
+        frame.dirY = (double)frame.dirYFixed / FIXED_ONE;
+        frame.planeX = (double)frame.planeXFixed / FIXED_ONE;
+        frame.planeY = (double)frame.planeYFixed / FIXED_ONE;
+    } else {
+        frame.dirX = cos(dirAngle);
+        frame.dirY = sin(dirAngle);
+        frame.planeX = -frame.dirY * FOV_FACTOR;
+        frame.planeY = frame.dirX * FOV_FACTOR;
+    }
+
+    // Floor mip levels are shared by all bands, so they are brought up to date before dispatch
+    if (rowMipWidth != viewport_width || rowMipHeight != viewport_height || rowMipFixed != frame.fixed ||
+        rowMipEnabled != textureMipmaps) {
+        build_row_mip_levels(viewport_width, viewport_height, frame.fixed);
+    }
+
+    // Sprites are sorted once, then each band draws its own columns
+    frame.sprites = visibleSprites;
+    frame.numSprites = project_sprites(&frame);
+
+    // Columns are independent, so bands can be rendered in parallel
+    int threads = render_thread_count();
+    int bandWidth = renderBandWidth > 0 ? renderBandWidth : viewport_width;
+    if (threads > 1 && bandWidth < viewport_width) {
+        // Restart only when the thread count setting changes, not to retry threads that failed
+        if (renderPool.requested != threads - 1) {
+            render_pool_stop();
+            render_pool_start(threads - 1);
+        }
+        render_pool_run(&frame, bandWidth);
+    } else {
+        render_band(&frame, 0, viewport_width);
+    }
+    PHASE_FLUSH();
+}
+
+// Resolution levels, each halving the pixel count: width and height shifts
+const int resolutionShifts[NUM_RESOLUTION_LEVELS][2] = { {0, 0}, {1, 0}, {1, 1}, {2, 1}, {2, 2} };
+
+// Frame-time controller for the raycaster resolution
+typedef struct {
+    int level;               // Index into resolutionShifts
+    double averageNs;        // Smoothed frame work time
+    int cooldown;            // Frames left before the level may change again
+    SDL_Surface* buffers[NUM_RESOLUTION_LEVELS]; // Internal render buffers, created on first use
+} ResolutionControl;
+
+ResolutionControl resolution;
+int dynamicResolution = DYNAMIC_RESOLUTION;
+
+// Feed one frame's work time to the controller and pick the next level
+void update_resolution(Uint64 workNs) {
+    if (!dynamicResolution) {
+        resolution.level = 0;
+        return;
+    }
+
+    // Smooth over a few frames so one slow frame does not switch levels
+    if (resolution.averageNs == 0) resolution.averageNs = workNs;
+    resolution.averageNs += (workNs - resolution.averageNs) * 0.1;
+    if (resolution.cooldown > 0) {
+        resolution.cooldown--;
+        return;
+    }
+
+    // Halve the pixels when over budget, double them when that still leaves headroom
+    if (resolution.averageNs > FRAME_BUDGET_NS && resolution.level < NUM_RESOLUTION_LEVELS - 1) {
+        resolution.level++;
+        resolution.averageNs *= 0.5;
+        resolution.cooldown = RESOLUTION_COOLDOWN;
+    } else if (resolution.averageNs < FRAME_BUDGET_NS * 0.4 && resolution.level > 0) {
+        resolution.level--;
+        resolution.averageNs *= 2.0;
+        resolution.cooldown = RESOLUTION_COOLDOWN;
+    }
+}
+
+// Nearest-neighbour upscale by powers of two, each source row is expanded once and copied
+void upscale_surface(SDL_Surface* src, SDL_Surface* dst, int shiftX, int shiftY) {
+    int repeatX = 1 << shiftX;
+    for (int y = 0; y < dst->h; y += 1 << shiftY) {
+        const Uint32* srcRow = (const Uint32*)((const Uint8*)src->pixels + (y >> shiftY) * src->pitch);
+        Uint32* dstRow = (Uint32*)((Uint8*)dst->pixels + y * dst->pitch);
+
+        if (repeatX == 2) {
+            for (int x = 0; x + 1 < dst->w; x += 2) {
+                dstRow[x] = dstRow[x + 1] = srcRow[x >> 1];
+            }
+            if (dst->w & 1) dstRow[dst->w - 1] = srcRow[dst->w >> 1];
+        } else {
+            for (int x = 0; x < dst->w; x++) {
+                dstRow[x] = srcRow[x >> shiftX];
+            }
+        }
+
+        for (int r = 1; r < (1 << shiftY) && y + r < dst->h; r++) {
+            memcpy((Uint8*)dstRow + r * dst->pitch, dstRow, dst->w * sizeof(Uint32));
+        }
+    }
+}
+
+// Render the raycaster at the controller's resolution and upscale it into the viewport
+void raycaster_scaled(SDL_Surface* surface, int viewport_width, int viewport_height) {
+    int shiftX = resolutionShifts[resolution.level][0];
+    int shiftY = resolutionShifts[resolution.level][1];
+    if (shiftX == 0 && shiftY == 0) {
+        raycaster(surface, viewport_width, viewport_height);
+        return;
+    }
+
+    int width = (viewport_width + (1 << shiftX) - 1) >> shiftX;
+    int height = (viewport_height + (1 << shiftY) - 1) >> shiftY;
+    SDL_Surface* buffer = resolution.buffers[resolution.level];
+    if (!buffer) {
+        SDL_PixelFormat* fmt = surface->format;
+        buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 32, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0);
+        if (!buffer) {
+            raycaster(surface, viewport_width, viewport_height);
+            return;
+        }
+        resolution.buffers[resolution.level] = buffer;
+    }
+
+    raycaster(buffer, width, height);
+    SDL_LockSurface(surface);
+    upscale_surface(buffer, surface, shiftX, shiftY);
+    SDL_UnlockSurface(surface);
+}
+
+// Free the internal render buffers
+void free_resolution_buffers(void) {
+    for (int i = 0; i < NUM_RESOLUTION_LEVELS; i++) {
+        SDL_FreeSurface(resolution.buffers[i]);
+        resolution.buffers[i] = NULL;
+    }
+}
+
+// Cell and facing the explored cells were last updated for
+typedef struct {
+    int valid;
+    int x;
+    int y;
+    Direction dir;
+    int fullCircle;
+} FieldOfView;
+
+FieldOfView fieldOfView;
+
+// Grid step of each direction
+const int directionX[4] = { 1, 0, -1, 0 };
+const int directionY[4] = { 0, -1, 0, 1 };
+
+// Recursive shadowcasting over one octant: rows of cells at increasing depth along the forward
+// axis, each scanned from the diagonal towards the axis while its slope lies between start and
+// end. A run of opaque cells splits off the light above it into a recursive call.
+void cast_shadows(int cx, int cy, int row, double start, double end, int fwdX, int fwdY, int sideX, int sideY) {
+    if (start < end) return;
+    double nextStart = start;
+
+    for (int depth = row; depth <= FOV_RADIUS; depth++) {
+        int blocked = 0;
+        for (int lateral = depth; lateral >= 0; lateral--) {
+            double high = (lateral + 0.5) / (depth - 0.5);
+            double low = (lateral - 0.5) / (depth + 0.5);
+            if (start < low) continue;
+            if (end > high) break;
+
+            int x = cx + depth * fwdX + lateral * sideX;
+            int y = cy + depth * fwdY + lateral * sideY;
+            if (depth * depth + lateral * lateral <= FOV_RADIUS * FOV_RADIUS) mark_explored(x, y);
+
+            int opaque = ray_blocked(x, y);
+            if (blocked) {
+                if (opaque) {
+                    nextStart = low;
+                    continue;
+                }
+                blocked = 0;
+                start = nextStart;
+            } else if (opaque && depth < FOV_RADIUS) {
+                blocked = 1;
+                cast_shadows(cx, cy, depth + 1, start, high, fwdX, fwdY, sideX, sideY);
+                nextStart = low;
+            }
+        }
+        if (blocked) break;
+    }
+}
+
+// Mark the cells seen from x, y: the quarter facing dir (wider than the raycaster's view), or all
+// around with fullCircle, plus the cells next to the party. Costs the visible area, not the map.
+void update_explored(int x, int y, Direction dir, int fullCircle) {
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) mark_explored(x + dx, y + dy);
+    }
+
+    for (int d = 0; d < 4; d++) {
+        if (!fullCircle && d != (int)dir) continue;
+        int fwdX = directionX[d];
+        int fwdY = directionY[d];
+        cast_shadows(x, y, 1, 1.0, 0.0, fwdX, fwdY, -fwdY, fwdX);
+        cast_shadows(x, y, 1, 1.0, 0.0, fwdX, fwdY, fwdY, -fwdX);
+    }
+}
+
+// Update the explored cells when the party's cell or facing has changed
+// Returns the number of cells seen for the first time
+int refresh_field_of_view(int fullCircle) {
+    if (fieldOfView.valid && fieldOfView.x == gridX && fieldOfView.y == gridY &&
+        fieldOfView.dir == gridDir && fieldOfView.fullCircle == fullCircle) return 0;
+
+    fieldOfView.valid = 1;
+    fieldOfView.x = gridX;
+    fieldOfView.y = gridY;
+    fieldOfView.dir = gridDir;
+    fieldOfView.fullCircle = fullCircle;
+
+    exploredMap.changed = 0;
+    update_explored(gridX, gridY, gridDir, fullCircle);
+    return exploredMap.changed;
+}
+
+// Handle top-down input
+void handle_top_down_input(SDL_Event event) {
+    if (event.type == SDL_KEYDOWN) {
+        switch (event.key.keysym.sym) {
+            case SDLK_UP:
+                initiate_move_up(engineTicks);
+                break;
+            case SDLK_DOWN:
+                initiate_move_down(engineTicks);
+                break;
+            case SDLK_LEFT:
+                initiate_move_left(engineTicks);
+                break;
+            case SDLK_RIGHT:
+                initiate_move_right(engineTicks);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Smooth scrolling of the top-down view towards cameraX, cameraY
+typedef struct {
+    int valid;      // 0 = jump to the camera on the next frame
+    int active;     // Scrolling, redraw every frame
+    double x;       // Tile shown at the top-left of the viewport
+    double y;
+    double fromX;
+    double fromY;
+    int toX;
+    int toY;
+    Uint32 start;
+} CameraScroll;
+
+CameraScroll cameraScroll;
+
+// Free the layer
+void free_top_down_layer(void) {
+    SDL_FreeSurface(topDownLayer.surface);
+    free(topDownLayer.tags);
+    free(topDownLayer.drawn);
+    memset(&topDownLayer, 0, sizeof(topDownLayer));
+}
+
+// Create the layer for a viewport size, big enough that one frame never shows a slot twice
+int ensure_top_down_layer(SDL_Surface* surface, int tile_size) {
+    int tilesX = surface->w / tile_size + 2;
+    int tilesY = surface->h / tile_size + 2;
+    if (topDownLayer.surface && topDownLayer.tileSize == tile_size &&
+        topDownLayer.tilesX == tilesX && topDownLayer.tilesY == tilesY) return 1;
+
+    SDL_FreeSurface(topDownLayer.surface);
+    free(topDownLayer.tags);
+    free(topDownLayer.drawn);
+    const SDL_PixelFormat* format = surface->format;
+    topDownLayer.surface = SDL_CreateRGBSurface(SDL_SWSURFACE, tilesX * tile_size, tilesY * tile_size, format->BitsPerPixel,
+                                                format->Rmask, format->Gmask, format->Bmask, format->Amask);
+    topDownLayer.tags = malloc(tilesX * tilesY * sizeof(Uint32));
+    topDownLayer.drawn = malloc(tilesX * tilesY);
+    topDownLayer.tileSize = tile_size;
+    topDownLayer.tilesX = tilesX;
+    topDownLayer.tilesY = tilesY;
+    if (!topDownLayer.surface || !topDownLayer.tags || !topDownLayer.drawn) {
+        printf("Unable to create top-down layer: %s\n", SDL_GetError());
+        free_top_down_layer();
+        return 0;
+    }
+    invalidate_layer();
+    return 1;
+}
+
+// Draw a map tile into its layer slot unless the slot already holds it
+void update_layer_tile(int mapX, int mapY) {
+    int slot = layer_slot(mapX, mapY);
+    Uint32 tag = layer_tag(mapX, mapY);
+    if (topDownLayer.drawn[slot] && topDownLayer.tags[slot] == tag) return;
+    topDownLayer.tags[slot] = tag;
+    topDownLayer.drawn[slot] = 1;
+
+    int tile_size = topDownLayer.tileSize;
+    SDL_Rect dstRect = { (slot % topDownLayer.tilesX) * tile_size, (slot / topDownLayer.tilesX) * tile_size, tile_size, tile_size };
+
+    // Clear the slot first, translucent atlas texels must not blend with the tile it held before
+    SDL_FillRect(topDownLayer.surface, &dstRect, SDL_MapRGB(topDownLayer.surface->format, 0, 0, 0));
+    if (!in_map(mapX, mapY) || (FOG_OF_WAR && !cell_explored(mapX, mapY))) return;
+
+    Cell cell = get_cell(mapX, mapY);
+    uint8_t textureIndex = get_texture_index(cell);
+
+    if (textureIndex < NUM_TEX) {
+        // Calculate texture coordinates in texture atlas
+        int texCol = textureIndex % ATLAS_COLUMNS;
+        int texRow = textureIndex / ATLAS_COLUMNS;
+        SDL_Rect srcRect = { texCol * TILE_SIZE, texRow * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+        SDL_BlitSurface(texture_atlas, &srcRect, topDownLayer.surface, &dstRect);
+    } else {
+        // Render default texture if textureIndex out of bounds
+        SDL_FillRect(topDownLayer.surface, &dstRect, SDL_MapRGB(topDownLayer.surface->format, 255, 0, 255)); // Magenta for errors
+    }
+}
+
+// Top-down view rendering function
+// Tiles are drawn into the cached layer only when they come into view or change, each frame
+// is then at most four blits from the layer, split where it wraps around
+void render_top_down(SDL_Surface* surface, int tile_size) {
+    int vptilesx = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH) / tile_size;   // Number of horizontal tiles in viewport
+    int vptilesy = (RESO_Y * UP_SHARE) / (UP_SHARE + DN_SHARE) / tile_size;   // Number of vertical tiles in viewport
+    float xcamoff = ((RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH)) - vptilesx; // Calculate camera X offset 
+    float ycamoff = ((RESO_X * UP_SHARE) / (VP_WIDTH + UP_SHARE)) - vptilesy; // Calculate camera Y offset 
+
+    // Set thresholds for camera movement
+    int xthreshold = 7;
+    int ythreshold = 4;
+
+    // Check if player at left or right threshold, then center the camera on the player
+    if (playerX - cameraX <= xthreshold || playerX - cameraX >= vptilesx - xthreshold) {
+        cameraX = (int)playerX - vptilesx / 2;
+    }
+
+    // Check if player at bottom or top threshold
+    if (playerY - cameraY <= ythreshold || playerY - cameraY >= vptilesy - ythreshold) {
+        cameraY = (int)playerY - vptilesy / 2;
+    }
+
+    // Clamp camera position to map boundaries
+    if (cameraX < 0) cameraX = 0;
+    if (cameraY < 0) cameraY = 0;
+    if (cameraX > mapWidth - vptilesx) cameraX = mapWidth - vptilesx;
+    if (cameraY > mapHeight - vptilesy) cameraY = mapHeight - vptilesy;
+
+    // Scroll towards the camera position
+    Uint32 currentTime = engineTicks;
+    if (!cameraScroll.valid) {
+        cameraScroll.valid = 1;
+        cameraScroll.active = 0;
+        cameraScroll.x = cameraScroll.toX = cameraX;
+        cameraScroll.y = cameraScroll.toY = cameraY;
+    } else if (cameraX != cameraScroll.toX || cameraY != cameraScroll.toY) {
+        cameraScroll.active = 1;
+        cameraScroll.start = currentTime;
+        cameraScroll.fromX = cameraScroll.x;
+        cameraScroll.fromY = cameraScroll.y;
+        cameraScroll.toX = cameraX;
+        cameraScroll.toY = cameraY;
+    }
+    if (cameraScroll.active) {
+        double t = (double)(currentTime - cameraScroll.start) / CAMERA_SCROLL_DURATION;
+        if (t >= 1.0) {
+            cameraScroll.x = cameraScroll.toX;
+            cameraScroll.y = cameraScroll.toY;
+            cameraScroll.active = 0;
+        } else {
+            cameraScroll.x = cameraScroll.fromX + (cameraScroll.toX - cameraScroll.fromX) * t;
+            cameraScroll.y = cameraScroll.fromY + (cameraScroll.toY - cameraScroll.fromY) * t;
+        }
+    }
+
+    if (!ensure_top_down_layer(surface, tile_size)) return;
+
+    // Bring the tiles in view up to date, including partly visible edges
+    int pixelX = (int)floor(cameraScroll.x * tile_size);
+    int pixelY = (int)floor(cameraScroll.y * tile_size);
+    int firstX = (int)floor((double)pixelX / tile_size);
+    int firstY = (int)floor((double)pixelY / tile_size);
+    int lastX = (int)floor((double)(pixelX + surface->w - 1) / tile_size);
+    int lastY = (int)floor((double)(pixelY + surface->h - 1) / tile_size);
+    for (int y = firstY; y <= lastY; y++) {
+        for (int x = firstX; x <= lastX; x++) {
+            update_layer_tile(x, y);
+        }
+    }
+
+    // Copy the view out of the layer
+    int layerW = topDownLayer.surface->w;
+    int layerH = topDownLayer.surface->h;
+    int srcY = wrap_index(pixelY, layerH);
+    for (int dstY = 0; dstY < surface->h;) {
+        int h = layerH - srcY;
+        if (h > surface->h - dstY) h = surface->h - dstY;
+        int srcX = wrap_index(pixelX, layerW);
+        for (int dstX = 0; dstX < surface->w;) {
+            int w = layerW - srcX;
+            if (w > surface->w - dstX) w = surface->w - dstX;
+            SDL_Rect srcRect = { srcX, srcY, w, h };
+            SDL_Rect dstRect = { dstX, dstY, w, h };
+            SDL_BlitSurface(topDownLayer.surface, &srcRect, surface, &dstRect);
+            dstX += w;
+            srcX = 0;
+        }
+        dstY += h;
+        srcY = 0;
+    }
+
+    // Render player sprite
+    SDL_Rect playerRect = {
+        (int)((playerX - cameraScroll.x) * tile_size - tile_size / 2),
+        (int)((playerY - cameraScroll.y) * tile_size - tile_size / 2),
+        tile_size,
+        tile_size
+    };
+    SDL_BlitSurface(playerSprite, NULL, surface, &playerRect);
+}
+
+// Asset cache entry, keyed by path and size (0x0 for the native size)
+typedef struct {
+    char path[ASSET_PATH_MAX];
+    int width;
+    int height;
+    SDL_Surface* surface;
+    int refs;
+    Uint32 lastUse;
+    size_t bytes;
+} Asset;
+
+Asset assets[MAX_ASSETS];
+int numAssets = 0;
+size_t assetBytes = 0;
+size_t assetBudget = ASSET_BUDGET;
+Uint32 assetClock = 0;
+
+// Find a cached asset
+Asset* find_asset(const char* path, int width, int height) {
+    for (int i = 0; i < numAssets; i++) {
+        if (assets[i].width == width && assets[i].height == height && strcmp(assets[i].path, path) == 0) {
+            return &assets[i];
+        }
+    }
+    return NULL;
+}
+
+// Free the asset in a slot
+void remove_asset(int index) {
+    assetBytes -= assets[index].bytes;
+    SDL_FreeSurface(assets[index].surface);
+    assets[index] = assets[--numAssets];
+}
+
+// Evict least recently used unreferenced assets until needed bytes fit the budget
+void evict_assets(size_t needed) {
+    while (assetBudget > 0 && assetBytes + needed > assetBudget) {
+        int victim = -1;
+        for (int i = 0; i < numAssets; i++) {
+            if (assets[i].refs == 0 && (victim < 0 || assets[i].lastUse < assets[victim].lastUse)) {
+                victim = i;
+            }
+        }
+        if (victim < 0) break;
+        remove_asset(victim);
+    }
+}
+
+// Decode an image into display format, scaled when a size is given
+SDL_Surface* load_asset_surface(const char* path, int width, int height) {
+    SDL_Surface* image = IMG_Load(path);
+    if (!image) return NULL;
+
+    SDL_Surface* converted = image->format->Amask ? SDL_DisplayFormatAlpha(image) : SDL_DisplayFormat(image);
+    SDL_FreeSurface(image);
+    if (!converted || width == 0 || height == 0 || (converted->w == width && converted->h == height)) {
+        return converted;
+    }
+
+    SDL_PixelFormat* fmt = converted->format;
+    SDL_Surface* scaled = SDL_CreateRGBSurface(converted->flags & SDL_SRCALPHA, width, height, fmt->BitsPerPixel,
+                                               fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+    if (scaled) SDL_SoftStretch(converted, NULL, scaled, NULL);
+    SDL_FreeSurface(converted);
+    return scaled;
+}
+
+// Get an asset and take a reference to it, loading it on first use
+SDL_Surface* acquire_asset(const char* path, int width, int height) {
+    Asset* asset = find_asset(path, width, height);
+    if (!asset) {
+        if (strlen(path) >= ASSET_PATH_MAX) return NULL;
+
+        SDL_Surface* surface = load_asset_surface(path, width, height);
+        if (!surface) return NULL;
+
+        size_t bytes = (size_t)surface->pitch * surface->h;
+        evict_assets(bytes);
+        if (numAssets == MAX_ASSETS) evict_assets(assetBytes + 1);
+        if (numAssets == MAX_ASSETS) {
+            SDL_FreeSurface(surface);
+            SDL_SetError("Asset cache full");
+            return NULL;
+        }
+
+        asset = &assets[numAssets++];
+        strcpy(asset->path, path);
+        asset->width = width;
+        asset->height = height;
+        asset->surface = surface;
+        asset->refs = 0;
+        asset->bytes = bytes;
+        assetBytes += bytes;
+    }
+    asset->refs++;
+    asset->lastUse = ++assetClock;
+    return asset->surface;
+}
+
+// Drop a reference taken with acquire_asset, the asset stays cached until evicted
+void release_asset(SDL_Surface* surface) {
+    for (int i = 0; i < numAssets; i++) {
+        if (assets[i].surface == surface) {
+            if (assets[i].refs > 0) assets[i].refs--;
+            break;
+        }
+    }
+    evict_assets(0);
+}
+
+// Free every cached asset
+void free_assets(void) {
+    while (numAssets > 0) remove_asset(numAssets - 1);
+}
+
+// Get an art asset or quit
+SDL_Surface* acquire_art(const char* artfile, int width, int height) {
+    SDL_Surface* image = acquire_asset(artfile, width, height);
+    if (!image) {
+        printf("Failed to load image: %s\n", IMG_GetError());
+        SDL_Quit();
+        exit(1);
+    }
+    return image;
+}
+
+// Render art mode
+void render_art(SDL_Surface* vpscreen,const char* artfile) {
+    SDL_Surface* artImage = acquire_art(artfile, 0, 0);
+    SDL_BlitSurface(artImage, NULL, vpscreen, NULL);
+    release_asset(artImage);
+}
+
+// Render wide art
+void render_wideart(SDL_Surface* vpscreen, SDL_Surface* coscreen, const char* artfile) {
+    // Calculate viewport and column widths
+    int vpwidt = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH); 
+    int cowidt = RESO_X - vpwidt;
+
+    // Load art image, pre-scaled to span viewport and column
+    SDL_Surface* artImage = acquire_art(artfile, vpwidt + cowidt, vpscreen->h);
+
+    // Viewport half
+    SDL_Rect srcRectVP = { 0, 0, vpwidt, artImage->h };
+    SDL_Rect dstRectVP = { 0, 0, vpwidt, vpscreen->h };  // Full viewport height
+
+    // Blit to viewport
+    SDL_BlitSurface(artImage, &srcRectVP, vpscreen, &dstRectVP);
+
+    // Column half
+    SDL_Rect srcRectCO = { vpwidt, 0, cowidt, artImage->h };
+    SDL_Rect dstRectCO = { 0, 0, cowidt, coscreen->h };  // Full column height
+
+    // Blit to column
+    SDL_BlitSurface(artImage, &srcRectCO, coscreen, &dstRectCO);
+    release_asset(artImage);
+}
+
+#ifndef BENCH
+// Input recording: every frame of a session with the keys handled in it, so a replay takes
+// exactly the same steps. After the header ("GBRC" and a version byte) each record is a type
+// byte followed by unsigned LEB128 varints:
+//   RECORD_FRAME     engine milliseconds since the previous frame
+//   RECORD_KEY_DOWN  key symbol, modifiers
+//   RECORD_KEY_UP    key symbol, modifiers
+typedef enum {
+    RECORD_FRAME = 1,
+    RECORD_KEY_DOWN,
+    RECORD_KEY_UP
+} RecordType;
+
+// Where input comes from: SDL (optionally saved to a recording) or a recording being replayed
+typedef struct {
+    FILE* file;          // Recording written or replayed, NULL for plain live input
+    int replaying;
+    int next;            // Replay: type of the next record, already read (EOF at the end)
+    int quitSent;        // Replay: the SDL_QUIT ending the replay was delivered
+    Uint32 startTicks;   // Live: SDL_GetTicks() at engine time 0
+    SDL_Event pending;   // Live: event waited for before the frame started
+    int havePending;
+    int frames;
+} InputSource;
+
+InputSource input;
+
+// Write an unsigned LEB128 varint
+void write_varint(FILE* file, Uint32 value) {
+    while (value >= 0x80) {
+        fputc((int)(value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc((int)value, file);
+}
+
+// Read an unsigned LEB128 varint, 0 at the end of the file
+int read_varint(FILE* file, Uint32* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) return 0;
+        *value |= (Uint32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+    return 0;
+}
+
+// Take input from SDL, saving it to a recording unless path is NULL
+int start_live_input(const char* path) {
+    memset(&input, 0, sizeof(input));
+    input.startTicks = SDL_GetTicks();
+    if (!path) return 1;
+
+    input.file = fopen(path, "wb");
+    if (!input.file) {
+        printf("Unable to create recording: %s\n", path);
+        return 0;
+    }
+    fwrite(RECORD_MAGIC, 1, 4, input.file);
+    fputc(RECORD_VERSION, input.file);
+    return 1;
+}
+
+// Take input from a recording
+int start_replay_input(const char* path) {
+    memset(&input, 0, sizeof(input));
+    input.file = fopen(path, "rb");
+    char magic[4];
+    if (!input.file || fread(magic, 1, 4, input.file) != 4 || memcmp(magic, RECORD_MAGIC, 4) != 0 ||
+        fgetc(input.file) != RECORD_VERSION) {
+        printf("Unable to read recording: %s\n", path);
+        if (input.file) fclose(input.file);
+        input.file = NULL;
+        return 0;
+    }
+    input.replaying = 1;
+    input.next = fgetc(input.file);
+    return 1;
+}
+
+// Close the recording
+void stop_input(void) {
+    if (input.file) fclose(input.file);
+    input.file = NULL;
+}
+
+// Start a frame: wait for input when idle (live only) and advance the engine clock
+void begin_input_frame(int idle) {
+    input.frames++;
+    if (input.replaying) {
+        Uint32 elapsed;
+        if (input.next == RECORD_FRAME && read_varint(input.file, &elapsed)) {
+            engineTicks += elapsed;
+            input.next = fgetc(input.file);
         } else {
-            playerX = startX + (targetX - startX) * t;
-            playerY = startY + (targetY - startY) * t;
+            input.next = EOF;
         }
+        return;
+    }
+
+    if (idle && SDL_WaitEvent(&input.pending)) input.havePending = 1;
+    Uint32 now = SDL_GetTicks() - input.startTicks;
+    if (input.file) {
+        fputc(RECORD_FRAME, input.file);
+        write_varint(input.file, now - engineTicks);
     }
+    engineTicks = now;
 }
 
-// Update rotation
-void update_rotation(Uint32 currentTime) {
-    if (isRotating) {
-        Uint32 elapsed = currentTime - rotateStartTime;
-        double t = (double)elapsed / ROTATE_DURATION;
+// Get the next input event of this frame, 0 when there is none left
+int poll_input(SDL_Event* event) {
+    if (input.replaying) {
+        if (input.next == RECORD_KEY_DOWN || input.next == RECORD_KEY_UP) {
+            Uint32 sym, mod;
+            int down = input.next == RECORD_KEY_DOWN;
+            if (read_varint(input.file, &sym) && read_varint(input.file, &mod)) {
+                memset(event, 0, sizeof(*event));
+                event->type = down ? SDL_KEYDOWN : SDL_KEYUP;
+                event->key.state = down ? SDL_PRESSED : SDL_RELEASED;
+                event->key.keysym.sym = (SDLKey)sym;
+                event->key.keysym.mod = (SDLMod)mod;
+                input.next = fgetc(input.file);
+                return 1;
+            }
+            input.next = EOF;
+        }
 
-        if (t >= 1.0) {
-            dirAngle = targetAngle;
-            isRotating = 0;
+        // The replay ends where the recording does
+        if (input.next != RECORD_FRAME && !input.quitSent) {
+            memset(event, 0, sizeof(*event));
+            event->type = SDL_QUIT;
+            input.quitSent = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (input.havePending) {
+        *event = input.pending;
+        input.havePending = 0;
+    } else if (!SDL_PollEvent(event)) {
+        return 0;
+    }
+
+    if (input.file && (event->type == SDL_KEYDOWN || event->type == SDL_KEYUP)) {
+        fputc(event->type == SDL_KEYDOWN ? RECORD_KEY_DOWN : RECORD_KEY_UP, input.file);
+        write_varint(input.file, (Uint32)event->key.keysym.sym);
+        write_varint(input.file, (Uint32)event->key.keysym.mod);
+    }
+    return 1;
+}
+
+// Add bytes to an FNV-1a hash
+Uint64 hash_bytes(Uint64 hash, const void* data, size_t size) {
+    const Uint8* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Hash of the game state, the same after a recorded session and its replay
+Uint64 state_hash(void) {
+    Uint64 hash = 0xCBF29CE484222325ULL;
+    hash = hash_bytes(hash, &gridX, sizeof(gridX));
+    hash = hash_bytes(hash, &gridY, sizeof(gridY));
+    hash = hash_bytes(hash, &gridDir, sizeof(gridDir));
+    hash = hash_bytes(hash, &playerX, sizeof(playerX));
+    hash = hash_bytes(hash, &playerY, sizeof(playerY));
+    hash = hash_bytes(hash, &dirAngle, sizeof(dirAngle));
+    hash = hash_bytes(hash, &isMoving, sizeof(isMoving));
+    hash = hash_bytes(hash, &isRotating, sizeof(isRotating));
+    hash = hash_bytes(hash, &cameraX, sizeof(cameraX));
+    hash = hash_bytes(hash, &cameraY, sizeof(cameraY));
+    hash = hash_bytes(hash, &currentDisplayMode, sizeof(currentDisplayMode));
+    hash = hash_bytes(hash, eventFlags, sizeof(eventFlags));
+    return hash_bytes(hash, &engineTicks, sizeof(engineTicks));
+}
+
+int main(int argc, char* argv[]) {
+    // --record <file> saves the session's input, --replay <file> plays one back without a window
+    // and without frame pacing, --timings <file> writes the work time of every replayed frame.
+    // Replays render at full resolution, the controller would follow the machine's speed.
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* timingsPath = NULL;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            recordPath = argv[i + 1];
+        } else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0) {
+            replayPath = argv[i + 1];
+        } else if (i + 1 < argc && strcmp(argv[i], "--timings") == 0) {
+            timingsPath = argv[i + 1];
         } else {
-            dirAngle = startAngle + (targetAngle - startAngle) * t;
+            printf("Usage: %s [--record file | --replay file [--timings file]]\n", argv[0]);
+            return 1;
         }
+    }
+    if (replayPath) {
+        SDL_putenv("SDL_VIDEODRIVER=dummy");
+        dynamicResolution = 0;
+    }
 
-        // Wrap angle between 0 and 2π
-        if (dirAngle < 0) dirAngle += 2 * M_PI;
-        if (dirAngle >= 2 * M_PI) dirAngle -= 2 * M_PI;
+    // Initialize SDL
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        printf("Unable to initialize SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+
+    Uint32 lastTime = SDL_GetTicks();
+
+    // Create a window
+    SDL_Surface* screen = SDL_SetVideoMode(RESO_X, RESO_Y, 32, SDL_SWSURFACE);
+    if (!screen) {
+        printf("Unable to set video mode: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+
+    // Load the PNG font image
+    SDL_Surface* font_image = IMG_Load("font.png");
+    if (!font_image) {
+        printf("Unable to load font: %s\n", IMG_GetError());
+        SDL_Quit();
+        return 1;
+    }
+
+    // Convert the font to the screen format so glyph blits need no conversion
+    SDL_Surface* font_surface = SDL_DisplayFormatAlpha(font_image);
+    SDL_FreeSurface(font_image);
+    if (!font_surface) {
+        printf("Unable to convert font: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+    build_glyph_table();
+
+    // Load the PNG Texture Atlas 
+    load_texture_atlas("atlas.png");
+
+    // Load the PNG Character Sprite
+    load_player_sprite("pc.png");
+
+    // Set the window title
+    SDL_WM_SetCaption("Goldbox Game Engine Clone (InDev)", NULL);
+
+    // Calculate layout proportions
+    int viewport_width, column_width, viewport_height, column_height, dialogue_height;
+    calculate_layout(&viewport_width, &column_width, &viewport_height, &column_height, &dialogue_height);
+
+    // Screen placement of each region, and of the frame statistics overlay over the viewport
+    SDL_Rect regionRects[NUM_REGIONS] = {
+        {0, 0, viewport_width, viewport_height},
+        {viewport_width, 0, column_width, column_height},
+        {0, viewport_height, RESO_X, dialogue_height}
+    };
+    SDL_Rect overlayRect = {8, 8, 16 * (CHAR_WIDTH + CHAR_SPACING), 5 * (CHAR_HEIGHT + NLINE_SPACING) + 8};
+
+    // Regions are drawn straight into views of the screen, or into surfaces of their own that
+    // are then blitted to it. The text panels keep their surfaces either way, they only
+    // rasterise text when it changes.
+    TextPanel columnPanel, dialoguePanel;
+    if (!create_text_panel(&columnPanel, screen, column_width, column_height, 180, 70, 26, REGION_COLUMN) ||
+        !create_text_panel(&dialoguePanel, screen, RESO_X, dialogue_height, 200, 80, 30, REGION_DIALOGUE)) {
+        printf("Unable to create text surfaces: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+    SDL_Surface* viewport_surface;
+    SDL_Surface* column_surface;
+    SDL_Surface* dialogue_surface;
+    SDL_Surface* overlay_surface;
+    if (directCompositing) {
+        viewport_surface = create_screen_view(screen, regionRects[REGION_VIEWPORT]);
+        column_surface = create_screen_view(screen, regionRects[REGION_COLUMN]);
+        dialogue_surface = create_screen_view(screen, regionRects[REGION_DIALOGUE]);
+        overlay_surface = create_screen_view(screen, overlayRect);
+    } else {
+        viewport_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, viewport_width, viewport_height, 32, 0, 0, 0, 0);
+        column_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, column_width, column_height, 32, 0, 0, 0, 0);
+        dialogue_surface = dialoguePanel.surface;
+        overlay_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, overlayRect.w, overlayRect.h, 32, 0, 0, 0, 0);
+    }
+    if (!viewport_surface || !column_surface || !dialogue_surface) {
+        printf("Unable to create region surfaces: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+
+    // Initialize the world map and its event scripts
+    const char* mapFilename = "map.bin";
+    initialize_worldMap(mapFilename, "atlas.png");
+    load_map_event_scripts(mapFilename);
+    build_light_tables();
+
+    // Panel text, rasterised once and again only when it changes
+    set_panel_text(&columnPanel, "This is the \ninfo column.\nCharacter info\nor stats could\ngo here!");
+    set_panel_text(&dialoguePanel, "This is the dialogue box, which explains what]s\ngoing on, and conveys story info.");
+
+    // Set initial display mode
+    currentDisplayMode = DISPLAY_MODE_RAYCASTER;
+
+    // Event loop
+    int running = 1;
+    SDL_Event event;
+    pacer_reset();
+
+    // Input source, and the file for replayed frame times
+    if (replayPath ? !start_replay_input(replayPath) : !start_live_input(recordPath)) {
+        SDL_Quit();
+        return 1;
+    }
+    FILE* timingsFile = NULL;
+    if (replayPath && timingsPath) {
+        timingsFile = fopen(timingsPath, "w");
+        if (!timingsFile) printf("Unable to create timings file: %s\n", timingsPath);
+    }
+    if (timingsFile) {
+        fprintf(timingsFile, "# frame work-ns, resolution level %d (%dx%d pixels per sample)\n", resolution.level,
+                1 << resolutionShifts[resolution.level][0], 1 << resolutionShifts[resolution.level][1]);
+    }
+    Uint64 replayStart = get_time_ns();
+
+    while (running) {
+        // Nothing animating and nothing to redraw: sleep until the next event
+        int idle = !isMoving && !isRotating && !cameraScroll.active && !any_region_dirty();
+        begin_input_frame(idle);
+
+        // Event handling
+        while (poll_input(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = 0;
+            } else if (event.type == SDL_VIDEOEXPOSE) {
+                mark_all_dirty();
+            } else if (event.type == SDL_KEYDOWN) {
+                // Global input handling
+                if (event.key.keysym.sym == SDLK_ESCAPE) {
+                    running = 0;
+                } else if (event.key.keysym.sym == SDLK_TAB) {
+                    if (currentDisplayMode == DISPLAY_MODE_RAYCASTER) {
+                        currentDisplayMode = DISPLAY_MODE_TOPDOWN;
+                    } else if (currentDisplayMode == DISPLAY_MODE_TOPDOWN) {
+                        currentDisplayMode = DISPLAY_MODE_ART;
+                    } else if (currentDisplayMode == DISPLAY_MODE_ART) {
+                        currentDisplayMode = DISPLAY_MODE_WIDE_ART;
+                    } else {
+                        currentDisplayMode = DISPLAY_MODE_RAYCASTER;
+                    }
+                    cameraScroll.valid = 0; // The top-down view opens without scrolling
+                    cameraScroll.active = 0;
+                    mark_all_dirty();
+                } else if (event.key.keysym.sym == SDLK_F1) {
+                    // Toggle the frame statistics overlay, the viewport redraw clears it
+                    showFrameStats = !showFrameStats && overlay_surface;
+                    mark_dirty(REGION_VIEWPORT);
+#ifdef OVERDRAW
+                } else if (event.key.keysym.sym == SDLK_F2) {
+                    // Toggle the overdraw heat map in place of the raycaster view
+                    showOverdraw = !showOverdraw;
+                    mark_dirty(REGION_VIEWPORT);
+#endif
+                } else {
+                    // Handle input based on display mode
+                    switch (currentDisplayMode) {
+                        case DISPLAY_MODE_RAYCASTER:
+                            handle_raycasting_input(event);
+                            break;
+                        case DISPLAY_MODE_TOPDOWN:
+                            handle_top_down_input(event);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+            }
+        }
+
+        // Messages from events go to the dialogue box
+        if (eventMessage) {
+            set_panel_text(&dialoguePanel, eventMessage);
+            eventMessage = NULL;
+        }
+
+        // Frame work is timed from here to presentation
+        Uint64 workStart = get_time_ns();
+        int raycastFrame = 0;
+
+        // Update animations, the view changes on every animated frame including the last
+        if (isMoving || isRotating) {
+            Uint32 currentTime = engineTicks;
+            update_movement(currentTime);
+            update_rotation(currentTime);
+            mark_dirty(REGION_VIEWPORT);
+        }
+        if (cameraScroll.active) mark_dirty(REGION_VIEWPORT);
+
+        // Page the world in around the player
+        update_chunks(gridX, gridY);
+
+        // Reveal what the party sees, the automap sees all around
+        if (refresh_field_of_view(currentDisplayMode == DISPLAY_MODE_TOPDOWN) && currentDisplayMode == DISPLAY_MODE_TOPDOWN) {
+            mark_dirty(REGION_VIEWPORT);
+        }
+
+        // Rendering based on display mode
+        if (directCompositing) lock_screen_views(screen);
+        if (regionDirty[REGION_VIEWPORT]) {
+            // Clear the viewport surface, the raycaster writes every pixel itself
+            if (currentDisplayMode != DISPLAY_MODE_RAYCASTER) {
+                SDL_FillRect(viewport_surface, NULL, SDL_MapRGB(viewport_surface->format, 0, 0, 0));
+            }
+
+            switch (currentDisplayMode) {
+                case DISPLAY_MODE_RAYCASTER:
+                    raycaster_scaled(viewport_surface, viewport_width, viewport_height);
+#ifdef OVERDRAW
+                    if (showOverdraw) draw_overdraw_map(viewport_surface);
+#endif
+                    raycastFrame = 1;
+                    break;
+                case DISPLAY_MODE_TOPDOWN:
+                    render_top_down(viewport_surface, TILE_SIZE);
+                    break;
+                case DISPLAY_MODE_ART:
+                    render_art(viewport_surface, "test.png");
+                    break;
+                case DISPLAY_MODE_WIDE_ART:
+                    render_wideart(viewport_surface, column_surface, "widetest.png");
+                    mark_dirty(REGION_COLUMN);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Copy the cached text panel to the column surface
+        if (regionDirty[REGION_COLUMN] && currentDisplayMode != DISPLAY_MODE_WIDE_ART) {
+            SDL_BlitSurface(render_text_panel(&columnPanel, font_surface), NULL, column_surface, NULL);
+        }
+
+        // Refresh the dialogue box if its text changed
+        if (regionDirty[REGION_DIALOGUE]) {
+            SDL_Surface* panel = render_text_panel(&dialoguePanel, font_surface);
+            if (panel != dialogue_surface) SDL_BlitSurface(panel, NULL, dialogue_surface, NULL);
+        }
+
+        // Statistics overlay goes on top and is refreshed on every drawn frame
+        int drawn = any_region_dirty();
+        if (showFrameStats && drawn) {
+            draw_frame_stats(overlay_surface, font_surface);
+        }
+        if (directCompositing) unlock_screen_views(screen);
+
+        // Blit changed surfaces onto the main screen, views are there already
+        SDL_Surface* regionSurfaces[NUM_REGIONS] = { viewport_surface, column_surface, dialogue_surface };
+        SDL_Rect updateRects[NUM_REGIONS + 1];
+        int numUpdates = 0;
+
+        for (int i = 0; i < NUM_REGIONS; i++) {
+            if (!regionDirty[i]) continue;
+            if (!directCompositing) {
+                SDL_Rect dst = regionRects[i];
+                SDL_BlitSurface(regionSurfaces[i], NULL, screen, &dst);
+            }
+            updateRects[numUpdates++] = regionRects[i];
+            regionDirty[i] = 0;
+        }
+        if (showFrameStats && drawn) {
+            if (!directCompositing) {
+                SDL_Rect dst = overlayRect;
+                SDL_BlitSurface(overlay_surface, NULL, screen, &dst);
+            }
+            updateRects[numUpdates++] = overlayRect;
+        }
+
+        // Update only the changed parts of the screen
+        if (numUpdates > 0) {
+            SDL_UpdateRects(screen, numUpdates, updateRects);
+        }
+
+        // Pick the raycaster resolution for the next frame from this frame's work
+        if (raycastFrame) update_resolution(get_time_ns() - workStart);
+
+        // Frame rate control, frames after sleeping for input start a new pacing run
+        // Replays run as fast as they can
+        if (input.replaying) {
+            if (timingsFile) fprintf(timingsFile, "%d %llu\n", input.frames, (unsigned long long)(get_time_ns() - workStart));
+        } else if (idle) {
+            pacer_reset();
+        } else {
+            pace_frame();
+        }
+    }
+
+    if (input.replaying) {
+        double seconds = (get_time_ns() - replayStart) / 1e9;
+        printf("Replayed %d frames in %.3f s (%.1f fps)\n", input.frames, seconds, seconds > 0 ? input.frames / seconds : 0.0);
+    } else if (recordPath) {
+        printf("Recorded %d frames to %s\n", input.frames, recordPath);
     }
+    if (input.file) printf("State hash %016llx\n", (unsigned long long)state_hash());
+    if (timingsFile) fclose(timingsFile);
+    stop_input();
+
+    if (directCompositing) {
+        free_screen_views();
+    } else {
+        SDL_FreeSurface(viewport_surface);
+        SDL_FreeSurface(column_surface);
+        SDL_FreeSurface(overlay_surface);
+    }
+    SDL_FreeSurface(columnPanel.surface);
+    SDL_FreeSurface(dialoguePanel.surface);
+    SDL_FreeSurface(font_surface);
+    free_assets();
+    free_resolution_buffers();
+    free_top_down_layer();
+    unload_map();
+    render_pool_stop();
+    SDL_Quit();
+
+    return 0;
 }
+#else
+// Camera keyframe for scripted benchmark paths
+typedef struct {
+    double x;
+    double y;
+    double angle;
+} BenchKey;
 
-// Handle raycaster input
-void handle_raycasting_input(SDL_Event event) {
-    if (event.type == SDL_KEYDOWN) {
-        Uint32 currentTime = SDL_GetTicks();
-        switch (event.key.keysym.sym) {
-            case SDLK_UP:
-                initiate_move_forward(currentTime);
-                break;
-            case SDLK_DOWN:
-                initiate_move_backward(currentTime);
-                break;
-            case SDLK_LEFT:
-                initiate_turn_left(currentTime);
-                break;
-            case SDLK_RIGHT:
-                initiate_turn_right(currentTime);
-                break;
-            default:
-                break;
+// Scripted camera path over map.bin
+typedef struct {
+    const char* name;
+    int numSprites; // Sprites scattered over the map while on this path
+    int numKeys;
+    BenchKey keys[8];
+} BenchPath;
+
+const BenchPath benchPaths[] = {
+    { "spin", 0, 2, { {12.5, 12.5, 0.0}, {12.5, 12.5, 2 * M_PI} } },
+    { "hall", 0, 2, { {1.5, 13.5, 0.0}, {28.5, 13.5, 0.0} } },
+    { "rooms", 0, 6, { {3.5, 1.5, M_PI / 2}, {3.5, 8.5, M_PI / 2}, {3.5, 8.5, 0.0},
+                    {16.5, 8.5, 0.0}, {16.5, 13.5, M_PI / 2}, {27.5, 13.5, 0.0} } },
+    { "wing", 0, 4, { {24.5, 10.5, M_PI / 2}, {24.5, 22.5, M_PI / 2},
+                      {24.5, 22.5, 3 * M_PI / 2}, {24.5, 10.5, 3 * M_PI / 2} } },
+    { "crowd", 64, 2, { {12.5, 12.5, 0.0}, {12.5, 12.5, 2 * M_PI} } }
+};
+#define NUM_BENCH_PATHS (int)(sizeof(benchPaths) / sizeof(benchPaths[0]))
+
+// Place the camera at time t (0..1) along a path
+void bench_set_camera(const BenchPath* path, double t) {
+    double pos = t * (path->numKeys - 1);
+    int i = (int)pos;
+    if (i >= path->numKeys - 1) i = path->numKeys - 2;
+    double f = pos - i;
+
+    const BenchKey* a = &path->keys[i];
+    const BenchKey* b = &path->keys[i + 1];
+    playerX = a->x + (b->x - a->x) * f;
+    playerY = a->y + (b->y - a->y) * f;
+    dirAngle = a->angle + (b->angle - a->angle) * f;
+    update_chunks((int)playerX, (int)playerY);
+}
+
+// Scatter sprites over floor cells (fixed seed, so every run is the same)
+void bench_spawn_sprites(int count) {
+    Uint32 seed = 12345;
+    clear_sprites();
+
+    while (numSprites < count) {
+        seed = seed * 1103515245 + 12345;
+        int x = (seed >> 8) % mapWidth;
+        seed = seed * 1103515245 + 12345;
+        int y = (seed >> 8) % mapHeight;
+
+        if (get_tile_type(get_cell(x, y)) == 0) {
+            add_sprite(x + 0.5, y + 0.5, (x + y) % 3);
+        }
+    }
+}
+
+// Sort helper for frame times
+int compare_u64(const void* a, const void* b) {
+    Uint64 x = *(const Uint64*)a;
+    Uint64 y = *(const Uint64*)b;
+    return (x > y) - (x < y);
+}
+
+// Print frame time statistics and per-phase split
+void bench_report(const char* name, Uint64* frameTimes, int frames, const Uint64* phases) {
+    Uint64 total = 0;
+    for (int i = 0; i < frames; i++) total += frameTimes[i];
+    qsort(frameTimes, frames, sizeof(Uint64), compare_u64);
+
+    int p99 = (frames * 99) / 100;
+    if (p99 >= frames) p99 = frames - 1;
+
+    printf("%-8s %6d frames %8.1f fps  min %6.3f  avg %6.3f  p99 %6.3f ms\n",
+           name, frames, frames / (total / 1e9),
+           frameTimes[0] / 1e6, total / 1e6 / frames, frameTimes[p99] / 1e6);
+
+    const char* phaseNames[NUM_PHASES] = { "dda", "floor", "wall", "sprite", "blit" };
+    printf("         ");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        printf(" %s %.3f ms (%.0f%%)", phaseNames[p], phases[p] / 1e6 / frames, total ? 100.0 * phases[p] / total : 0.0);
+    }
+    printf("\n");
+}
+
+// Compare output with the single-threaded scalar path along every path
+void bench_check_equivalence(SDL_Surface* surface, int width, int height) {
+    SDL_Surface* reference = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 32, 0, 0, 0, 0);
+    int threads = renderThreads;
+    int simd = raySimd;
+    int mismatches = 0;
+
+    for (int p = 0; p < NUM_BENCH_PATHS; p++) {
+        bench_spawn_sprites(benchPaths[p].numSprites);
+        for (int i = 0; i <= 8; i++) {
+            bench_set_camera(&benchPaths[p], i / 8.0);
+
+            renderThreads = 1;
+            raySimd = 0;
+            select_ray_caster();
+            raycaster(reference, width, height);
+
+            renderThreads = threads;
+            raySimd = simd;
+            select_ray_caster();
+            raycaster(surface, width, height);
+
+            for (int y = 0; y < height; y++) {
+                if (memcmp((Uint8*)reference->pixels + y * reference->pitch,
+                           (Uint8*)surface->pixels + y * surface->pitch, width * sizeof(Uint32)) != 0) {
+                    mismatches++;
+                    break;
+                }
+            }
         }
     }
+
+    memset(phaseTime, 0, sizeof(phaseTime));
+    SDL_FreeSurface(reference);
+    if (mismatches) {
+        printf("WARNING: output differs from single-threaded scalar path in %d frames\n", mismatches);
+    } else {
+        printf("Output matches single-threaded scalar path\n");
+    }
 }
 
-// Raycaster
-void raycaster(SDL_Surface* surface, int viewport_width, int viewport_height) {
-    // Clear the viewport
-    SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
-
-    // Floor and ceiling colors
-    Uint32 floorColor = SDL_MapRGB(surface->format, 50, 50, 50);
-    Uint32 ceilingColor = SDL_MapRGB(surface->format, 20, 20, 20);
+// Camera pose for the golden-image check
+typedef struct {
+    double x;
+    double y;
+    double angle;
+} GoldenPose;
+
+// Poses over map.bin: open rooms, hugging walls, corners and angles off the axes
+const GoldenPose goldenPoses[] = {
+    {12.5, 12.5, 0.0}, {12.5, 12.5, M_PI / 4}, {1.5, 13.5, 0.0}, {28.5, 13.5, M_PI},
+    {3.5, 1.5, M_PI / 2}, {3.5, 8.5, 0.3}, {16.5, 8.5, 2.0}, {24.5, 22.5, 3 * M_PI / 2},
+    {1.05, 1.05, M_PI / 4}, {27.5, 13.5, 5.5}
+};
+#define NUM_GOLDEN_POSES (int)(sizeof(goldenPoses) / sizeof(goldenPoses[0]))
+
+// Text drawn by the golden-image check, including characters missing from the font
+const char* goldenTexts[] = {
+    "This is the \ninfo column.\nCharacter info\nor stats could\ngo here!",
+    "This is the dialogue box, which explains what]s\ngoing on, and conveys story info.",
+    "0123456789 .,!?:;[]{}*^-+=<>|~@#$%&\nabc\xc3\xa9xyz \xe2\x82\xac \x01 ZZ",
+    ""
+};
+#define NUM_GOLDEN_TEXTS (int)(sizeof(goldenTexts) / sizeof(goldenTexts[0]))
+
+// Limits of the golden-image check
+typedef struct {
+    int channelTolerance;  // Largest per-channel difference still counted as equal
+    int pixelTolerance;    // Differing pixels allowed per image
+    const char* diffDir;   // Where diff images of failing cases go (NULL = nowhere)
+    int cases;
+    int failures;
+} GoldenCheck;
+
+GoldenCheck golden;
+
+// Place the camera at a golden pose, with the grid position the top-down view and field of view use
+void golden_set_pose(const GoldenPose* pose) {
+    playerX = pose->x;
+    playerY = pose->y;
+    dirAngle = pose->angle;
+    gridX = (int)pose->x;
+    gridY = (int)pose->y;
+    int quadrant = (int)floor(pose->angle / (M_PI / 2) + 0.5) & 3;
+    gridDir = (Direction)((4 - quadrant) & 3);
+    update_chunks(gridX, gridY);
+}
 
-    // Draw floor and ceiling
-    SDL_Rect floorRect = {0, viewport_height / 2, viewport_width, viewport_height / 2};
-    SDL_FillRect(surface, &floorRect, floorColor);
-    SDL_Rect ceilingRect = {0, 0, viewport_width, viewport_height / 2};
-    SDL_FillRect(surface, &ceilingRect, ceilingColor);
+// Largest channel difference between two pixels of a format
+int pixel_difference(const SDL_PixelFormat* format, Uint32 a, Uint32 b) {
+    Uint8 ar, ag, ab, br, bg, bb;
+    SDL_GetRGB(a, (SDL_PixelFormat*)format, &ar, &ag, &ab);
+    SDL_GetRGB(b, (SDL_PixelFormat*)format, &br, &bg, &bb);
+    int diff = abs(ar - br);
+    if (abs(ag - bg) > diff) diff = abs(ag - bg);
+    if (abs(ab - bb) > diff) diff = abs(ab - bb);
+    return diff;
+}
 
-    // Calculate direction vector and camera plane based on dirAngle
-    double dirX = cos(dirAngle);
-    double dirY = sin(dirAngle);
-    double planeX = -dirY * 0.66; // FOV factor
-    double planeY = dirX * 0.66;
-
-    // Raycasting loop
-    for (int x = 0; x < viewport_width; x++) {
-        // Calculate ray position and direction
-        double cameraX = 2 * x / (double)viewport_width - 1; // x-coordinate in camera space
-        double rayDirX = dirX + planeX * cameraX;
-        double rayDirY = dirY + planeY * cameraX;
-
-        // Map position
-        int mapX = (int)playerX;
-        int mapY = (int)playerY;
-
-        // Length of ray from current position to next x or y-side
-        double sideDistX;
-        double sideDistY;
-
-        // Length of ray from one x or y-side to next x or y-side
-        double deltaDistX = (rayDirX == 0) ? 1e30 : fabs(1 / rayDirX);
-        double deltaDistY = (rayDirY == 0) ? 1e30 : fabs(1 / rayDirY);
-        double perpWallDist;
-
-        // Direction to go in x and y (+1 or -1)
-        int stepX;
-        int stepY;
-
-        int hit = 0; // Was a wall hit?
-        int side;    // Was a NS or a EW wall hit?
-
-        // Calculate step and initial sideDist
-        if (rayDirX < 0) {
-            stepX = -1;
-            sideDistX = (playerX - mapX) * deltaDistX;
-        } else {
-            stepX = 1;
-            sideDistX = (mapX + 1.0 - playerX) * deltaDistX;
+// Compare an optimised image with its reference and record the result. A failing case writes a
+// diff image: the reference darkened, differing pixels in red.
+void golden_compare(const char* name, int index, SDL_Surface* reference, SDL_Surface* optimised) {
+    int differing = 0;
+    int largest = 0;
+    for (int y = 0; y < reference->h; y++) {
+        const Uint32* refRow = (const Uint32*)((const Uint8*)reference->pixels + y * reference->pitch);
+        const Uint32* optRow = (const Uint32*)((const Uint8*)optimised->pixels + y * optimised->pitch);
+        for (int x = 0; x < reference->w; x++) {
+            if (refRow[x] == optRow[x]) continue;
+            int diff = pixel_difference(reference->format, refRow[x], optRow[x]);
+            if (diff > largest) largest = diff;
+            if (diff > golden.channelTolerance) differing++;
         }
-        if (rayDirY < 0) {
-            stepY = -1;
-            sideDistY = (playerY - mapY) * deltaDistY;
-        } else {
-            stepY = 1;
-            sideDistY = (mapY + 1.0 - playerY) * deltaDistY;
+    }
+
+    golden.cases++;
+    if (differing <= golden.pixelTolerance) return;
+    golden.failures++;
+    printf("FAIL %-10s %2d: %d pixels differ (largest channel difference %d)\n", name, index, differing, largest);
+    if (!golden.diffDir) return;
+
+    SDL_Surface* diff = SDL_CreateRGBSurface(SDL_SWSURFACE, reference->w, reference->h, 32, 0xFF0000, 0xFF00, 0xFF, 0);
+    if (!diff) return;
+    Uint32 red = SDL_MapRGB(diff->format, 255, 0, 0);
+    for (int y = 0; y < reference->h; y++) {
+        const Uint32* refRow = (const Uint32*)((const Uint8*)reference->pixels + y * reference->pitch);
+        const Uint32* optRow = (const Uint32*)((const Uint8*)optimised->pixels + y * optimised->pitch);
+        Uint32* diffRow = (Uint32*)((Uint8*)diff->pixels + y * diff->pitch);
+        for (int x = 0; x < reference->w; x++) {
+            Uint8 r, g, b;
+            SDL_GetRGB(refRow[x], reference->format, &r, &g, &b);
+            diffRow[x] = pixel_difference(reference->format, refRow[x], optRow[x]) > golden.channelTolerance
+                         ? red : SDL_MapRGB(diff->format, r / 4, g / 4, b / 4);
         }
+    }
 
-        // Perform DDA
-        while (hit == 0) {
-            // Jump to next map square in x or y direction
-            if (sideDistX < sideDistY) {
-                sideDistX += deltaDistX;
-                mapX += stepX;
-                side = 0; // NS wall
-            } else {
-                sideDistY += deltaDistY;
-                mapY += stepY;
-                side = 1; // EW wall
-            }
-            // Check if ray has hit a wall
-            if (mapX >= 0 && mapX < MAP_WIDTH && mapY >= 0 && mapY < MAP_HEIGHT) {
-                if (get_tile_type(worldMap[mapX][mapY]) > 0) hit = 1;
+    char path[ASSET_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/golden-%s-%02d.bmp", golden.diffDir, name, index);
+    if (SDL_SaveBMP(diff, path) == 0) printf("     diff written to %s\n", path);
+    SDL_FreeSurface(diff);
+}
+
+// Reference top-down view: every visible tile drawn straight from the atlas, at the scroll
+// position render_top_down() left in cameraScroll
+void render_top_down_reference(SDL_Surface* surface, int tile_size) {
+    SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
+    int pixelX = (int)floor(cameraScroll.x * tile_size);
+    int pixelY = (int)floor(cameraScroll.y * tile_size);
+    int firstX = (int)floor((double)pixelX / tile_size);
+    int firstY = (int)floor((double)pixelY / tile_size);
+
+    for (int y = firstY; y * tile_size < pixelY + surface->h; y++) {
+        for (int x = firstX; x * tile_size < pixelX + surface->w; x++) {
+            if (!in_map(x, y) || (FOG_OF_WAR && !cell_explored(x, y))) continue;
+
+            SDL_Rect dstRect = { x * tile_size - pixelX, y * tile_size - pixelY, tile_size, tile_size };
+            uint8_t textureIndex = get_texture_index(get_cell(x, y));
+            if (textureIndex < NUM_TEX) {
+                SDL_Rect srcRect = { (textureIndex % ATLAS_COLUMNS) * TILE_SIZE, (textureIndex / ATLAS_COLUMNS) * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+                SDL_BlitSurface(texture_atlas, &srcRect, surface, &dstRect);
             } else {
-                // Out of bounds
-                hit = 1;
+                SDL_FillRect(surface, &dstRect, SDL_MapRGB(surface->format, 255, 0, 255));
             }
         }
+    }
 
-        // Avoid fish-eye
-        if (side == 0) {
-            perpWallDist = (mapX - playerX + (1 - stepX) / 2) / rayDirX;
-        } else {
-            perpWallDist = (mapY - playerY + (1 - stepY) / 2) / rayDirY;
-        }
+    SDL_Rect playerRect = {
+        (int)((playerX - cameraScroll.x) * tile_size - tile_size / 2),
+        (int)((playerY - cameraScroll.y) * tile_size - tile_size / 2),
+        tile_size,
+        tile_size
+    };
+    SDL_BlitSurface(playerSprite, NULL, surface, &playerRect);
+}
 
-        // Calculate height of line for screen
-        int lineHeight = (int)(viewport_height / perpWallDist);
+// Reference glyph lookup: a linear scan of the font character set
+int golden_char_index(const char* c, int* bytes_advance) {
+    unsigned char c0 = c[0];
+    *bytes_advance = (c0 & 0xE0) == 0xC0 ? 2 : 1;
+    if (c0 >= 0x80 && *bytes_advance == 1) return -1;
 
-        // Calculate lowest and highest pixel to fill in current stripe
-        int drawStart = -lineHeight / 2 + viewport_height / 2;
-        if (drawStart < 0) drawStart = 0;
-        int drawEnd = lineHeight / 2 + viewport_height / 2;
-        if (drawEnd >= viewport_height) drawEnd = viewport_height - 1;
+    int index = 0;
+    for (const char* p = fontCharSet; *p != '\0'; index++) {
+        int length = (unsigned char)*p < 0x80 ? 1 : 2;
+        if (length == *bytes_advance && memcmp(p, c, length) == 0) return index;
+        p += length;
+    }
+    return -1;
+}
 
-        // Get cell data
-        if (mapX < 0 || mapX >= MAP_WIDTH || mapY < 0 || mapY >= MAP_HEIGHT) {
-            // Default color if out of bounds
-            SDL_Rect wallRect = { x, drawStart, 1, drawEnd - drawStart };
-            SDL_FillRect(surface, &wallRect, SDL_MapRGB(surface->format, 255, 255, 255)); // White
+// Reference text rendering, one character at a time
+void draw_text_reference(SDL_Surface* surface, SDL_Surface* font_surface, int x, int y, const char* text) {
+    int x_offset = 0;
+    int y_offset = 0;
+    for (int i = 0; text[i] != '\0';) {
+        if (text[i] == '\n') {
+            y_offset += CHAR_HEIGHT + NLINE_SPACING;
+            x_offset = 0;
+            i++;
             continue;
         }
+        int bytes_advance;
+        int char_index = golden_char_index(&text[i], &bytes_advance);
+        draw_char(surface, font_surface, char_index, x + x_offset, y + y_offset);
+        x_offset += CHAR_WIDTH + CHAR_SPACING;
+        i += bytes_advance;
+    }
+}
 
-        Cell cell = worldMap[mapX][mapY];
-        uint8_t tileType = get_tile_type(cell);
-        uint8_t textureIndex = get_texture_index(cell);
+// Raycaster poses: the reference is the single-threaded scalar caster of the same arithmetic
+// (floating or fixed point), the optimised frame uses the configured threads and SIMD casters
+void golden_raycaster(SDL_Surface* reference, SDL_Surface* optimised, int fixed) {
+    int threads = renderThreads;
+    int simd = raySimd;
+    int fixedSetting = rayFixed;
+    const char* name = fixed ? "ray-fixed" : "ray-float";
+
+    for (int s = 0; s < 2; s++) {
+        bench_spawn_sprites(s ? 64 : 0);
+        for (int i = 0; i < NUM_GOLDEN_POSES; i++) {
+            golden_set_pose(&goldenPoses[i]);
+            rayFixed = fixed;
+
+            renderThreads = 1;
+            raySimd = 0;
+            select_ray_caster();
+            raycaster(reference, reference->w, reference->h);
+
+            renderThreads = threads;
+            raySimd = simd;
+            select_ray_caster();
+            raycaster(optimised, optimised->w, optimised->h);
+
+            golden_compare(name, s * NUM_GOLDEN_POSES + i, reference, optimised);
+        }
+    }
 
-        // Calculate texture coordinates in the atlas
-        int texCol = textureIndex % ATLAS_COLUMNS;
-        int texRow = textureIndex / ATLAS_COLUMNS;
-        int textureOffsetX = texCol * TILE_SIZE;
-        int textureOffsetY = texRow * TILE_SIZE;
+    clear_sprites();
+    rayFixed = fixedSetting;
+    select_ray_caster();
+}
 
-        // Calculate texture X coordinate for wall hit
-        double wallX;
-        if (side == 0) {
-            wallX = playerY + perpWallDist * rayDirY;
-        } else {
-            wallX = playerX + perpWallDist * rayDirX;
+// Top-down poses, walked in order so the layer cache carries over and the camera is caught
+// mid-scroll. Halfway through, a wall is opened to check the cache notices map edits.
+void golden_top_down(SDL_Surface* reference, SDL_Surface* optimised) {
+    cameraScroll.valid = 0;
+    int editX = 2, editY = 13;
+    Cell original = get_cell(editX, editY);
+
+    for (int i = 0; i < NUM_GOLDEN_POSES * 2; i++) {
+        golden_set_pose(&goldenPoses[i % NUM_GOLDEN_POSES]);
+        refresh_field_of_view(1);
+        if (i == NUM_GOLDEN_POSES) {
+            Cell opened = original;
+            opened.tileByte = (Uint8)((original.tileByte & TEXTURE_INDEX_MASK) ^ 1);
+            set_cell(editX, editY, opened);
         }
-        wallX -= floor(wallX);
-
-        int texX = (int)(wallX * (double)TILE_SIZE);
-        if (side == 0 && rayDirX > 0) texX = TILE_SIZE - texX - 1;
-        if (side == 1 && rayDirY < 0) texX = TILE_SIZE - texX - 1;
+        engineTicks += CAMERA_SCROLL_DURATION / 3;
 
-        // Floor rendering
-        for (int y = viewport_height / 2 + 1; y < viewport_height; y++) {
-            // Calculate distance from the player to this row
-            double currentDist = (double)viewport_height / (2.0 * y - viewport_height);
+        render_top_down(optimised, TILE_SIZE);
+        render_top_down_reference(reference, TILE_SIZE);
+        golden_compare("top-down", i, reference, optimised);
+    }
+    set_cell(editX, editY, original);
+}
 
-            // Calculate floor position at this distance
-            double floorX = playerX + currentDist * (rayDirX);
-            double floorY = playerY + currentDist * (rayDirY);
-
-            // Map position
-            int floorMapX = (int)(floorX);
-            int floorMapY = (int)(floorY);
-
-            if (floorMapX >= 0 && floorMapX < MAP_WIDTH && floorMapY >= 0 && floorMapY < MAP_HEIGHT) {
-                // Get cell from map
-                Cell floorCell = worldMap[floorMapX][floorMapY];
-                uint8_t floorTileType = floorCell.tileByte & TILE_TYPE_MASK;
-                uint8_t floorTextureIndex = floorCell.tileByte & TEXTURE_INDEX_MASK;
-
-                // Calculate texture coordinates
-                int floorTexX = (int)((floorX - floorMapX) * TILE_SIZE) & (TILE_SIZE - 1);
-                int floorTexY = (int)((floorY - floorMapY) * TILE_SIZE) & (TILE_SIZE - 1);
-
-                // Calculate texture position in atlas
-                int atlasColumns = texture_atlas->w / TILE_SIZE;
-                int texCol = floorTextureIndex % atlasColumns;
-                int texRow = floorTextureIndex / atlasColumns;
-                int textureOffsetX = texCol * TILE_SIZE;
-                int textureOffsetY = texRow * TILE_SIZE;
-
-                // Get color from texture atlas
-                Uint32 floorColor = get_pixel(texture_atlas, textureOffsetX + floorTexX, textureOffsetY + floorTexY);
-                    
-                // Calculate shading factor based on distance
-                double shadingFactor = 1 / (currentDist * 0.2 + 1.0); // Adjust 0.2 to control shading intensity
-
-                // Clamp shadingFactor between 0 and 1
-                if (shadingFactor < 0.0) shadingFactor = 0.0;
-                if (shadingFactor > 1.0) shadingFactor = 1.0;
-
-                // Apply shading to RGB components
-                Uint8 r, g, b;
-                SDL_GetRGB(floorColor, surface->format, &r, &g, &b);
-                r = (Uint8)(r * shadingFactor);
-                g = (Uint8)(g * shadingFactor);
-                b = (Uint8)(b * shadingFactor);
-                floorColor = SDL_MapRGB(surface->format, r, g, b);
-
-                // Draw floor pixel
-                put_pixel(surface, x, y, floorColor);
-            } else {
-                // Out of bounds
-            }
-        }
+// Text panels: the glyph-table renderer against the character-set scan
+void golden_text(SDL_Surface* reference, SDL_Surface* optimised, SDL_Surface* font_surface) {
+    Uint32 background = SDL_MapRGB(reference->format, 0, 0, 139);
+    for (int i = 0; i < NUM_GOLDEN_TEXTS; i++) {
+        SDL_FillRect(reference, NULL, background);
+        SDL_FillRect(optimised, NULL, background);
+        draw_text_reference(reference, font_surface, 10, 10, goldenTexts[i]);
+        draw_text(optimised, font_surface, 10, 10, goldenTexts[i]);
+        golden_compare("text", i, reference, optimised);
+    }
+}
 
-        // Draw texture stripe
-        for (int y = drawStart; y < drawEnd; y++) {
-            int d = y * 256 - viewport_height * 128 + lineHeight * 128;
-            int texY = ((d * TILE_SIZE) / lineHeight) / 256;
+// Golden-image check: every optimised renderer against its reference over fixed poses
+int golden_check(SDL_Surface* screen, int width, int height) {
+    SDL_PixelFormat* fmt = screen->format;
+    SDL_Surface* reference = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 32, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0);
+    SDL_Surface* optimised = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 32, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0);
+    SDL_Surface* font_image = IMG_Load("font.png");
+    SDL_Surface* font_surface = font_image ? SDL_DisplayFormatAlpha(font_image) : NULL;
+    SDL_FreeSurface(font_image);
+    load_player_sprite("pc.png");
+    if (!reference || !optimised || !font_surface) {
+        printf("Unable to set up golden-image check: %s\n", SDL_GetError());
+        SDL_FreeSurface(reference);
+        SDL_FreeSurface(optimised);
+        SDL_FreeSurface(font_surface);
+        return 0;
+    }
 
-            // Clamp texY to texture bounds
-            if (texY < 0) texY = 0;
-            if (texY >= TILE_SIZE) texY = TILE_SIZE - 1;
+    // Always split frames into bands, even on a single CPU
+    if (render_thread_count() < 4) renderThreads = 4;
+    select_ray_caster();
+    printf("Golden images %dx%d, %d render threads, %s rays, channel tolerance %d, pixel tolerance %d\n",
+           width, height, render_thread_count(), rayCasterName, golden.channelTolerance, golden.pixelTolerance);
 
-            // Get pixel from texture atlas
-            Uint32 color = get_pixel(texture_atlas, textureOffsetX + texX, textureOffsetY + texY);
-                    
-            // Calculate shading factor based on distance
-            double shadingFactor = 1.0 / (perpWallDist * 0.1 + 1.0); // Adjust 0.1 to control shading intensity
+    golden_raycaster(reference, optimised, 0);
+    golden_raycaster(reference, optimised, 1);
+    golden_top_down(reference, optimised);
+    golden_text(reference, optimised, font_surface);
 
-            // Clamp shadingFactor between 0 and 1
-            if (shadingFactor < 0.0) shadingFactor = 0.0;
-            if (shadingFactor > 1.0) shadingFactor = 1.0;
+    printf("%d of %d golden images match\n", golden.cases - golden.failures, golden.cases);
+    SDL_FreeSurface(reference);
+    SDL_FreeSurface(optimised);
+    SDL_FreeSurface(font_surface);
+    free_top_down_layer();
+    return golden.failures == 0;
+}
 
-            // Apply shading to RGB components
-            Uint8 r, g, b;
-            SDL_GetRGB(color, surface->format, &r, &g, &b);
-            r = (Uint8)(r * shadingFactor);
-            g = (Uint8)(g * shadingFactor);
-            b = (Uint8)(b * shadingFactor);
-            color = SDL_MapRGB(surface->format, r, g, b);
+// Generate a size x size maze with corridors `corridor` cells wide, carved depth-first with a
+// fixed seed, then knock out walls to add loops
+int bench_generate_maze(int size, int corridor) {
+    int pitch = corridor + 1;
+    int cells = (size - 1) / pitch; // Maze cells per side
+    if (cells < 1 || !create_map(size, size)) return 0;
+
+    // Open passages of each maze cell, bit i towards distStepX/Y[i]
+    Uint8* passages = calloc(cells * cells, 1);
+    int* stack = malloc(sizeof(int) * cells * cells);
+    if (!passages || !stack) {
+        free(passages);
+        free(stack);
+        return 0;
+    }
 
-            put_pixel(surface, x, y, color);
+    Uint32 seed = 4242;
+    int depth = 0;
+    stack[depth++] = 0;
+    passages[0] = 0x10; // Visited
+
+    while (depth > 0) {
+        int cell = stack[depth - 1];
+        int cx = cell % cells;
+        int cy = cell / cells;
+        int options[4];
+        int numOptions = 0;
+        for (int i = 0; i < 4; i++) {
+            int nx = cx + distStepX[i];
+            int ny = cy + distStepY[i];
+            if (nx >= 0 && ny >= 0 && nx < cells && ny < cells && !passages[ny * cells + nx]) options[numOptions++] = i;
+        }
+        if (numOptions == 0) {
+            depth--;
+            continue;
         }
+
+        seed = seed * 1103515245 + 12345;
+        int i = options[(seed >> 8) % numOptions];
+        int next = (cy + distStepY[i]) * cells + cx + distStepX[i];
+        passages[cell] |= 1 << i;
+        passages[next] |= 0x10 | (1 << ((i + 2) & 3));
+        stack[depth++] = next;
     }
-}
 
-// Handle top-down input
-void handle_top_down_input(SDL_Event event) {
-    if (event.type == SDL_KEYDOWN) {
-        switch (event.key.keysym.sym) {
-            case SDLK_UP:
-                initiate_move_up(SDL_GetTicks());
-                break;
-            case SDLK_DOWN:
-                initiate_move_down(SDL_GetTicks());
-                break;
-            case SDLK_LEFT:
-                initiate_move_left(SDL_GetTicks());
-                break;
-            case SDLK_RIGHT:
-                initiate_move_right(SDL_GetTicks());
-                break;
-            default:
-                break;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int cx = (x - 1) / pitch;
+            int cy = (y - 1) / pitch;
+            int rx = (x - 1) % pitch;
+            int ry = (y - 1) % pitch;
+            int open = 0;
+            if (x > 0 && y > 0 && cx < cells && cy < cells) {
+                Uint8 cell = passages[cy * cells + cx];
+                open = (rx < corridor && ry < corridor) ||
+                       (rx == corridor && ry < corridor && (cell & 2)) ||
+                       (ry == corridor && rx < corridor && (cell & 4));
+            }
+            worldMap[y * size + x].tileByte = open ? 0 : (TILE_TYPE_WALL | 1);
         }
     }
+    free(stack);
+    free(passages);
+
+    for (int i = 0; i < cells * cells / 16; i++) {
+        seed = seed * 1103515245 + 12345;
+        int x = 1 + (seed >> 8) % (size - 2);
+        seed = seed * 1103515245 + 12345;
+        int y = 1 + (seed >> 8) % (size - 2);
+        worldMap[y * size + x].tileByte = 0;
+    }
+    return 1;
 }
 
-// Top-down view rendering function
-void render_top_down(SDL_Surface* surface, int tile_size) {
-    int vptilesx = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH) / tile_size;   // Number of horizontal tiles in viewport
-    int vptilesy = (RESO_Y * UP_SHARE) / (UP_SHARE + DN_SHARE) / tile_size;   // Number of vertical tiles in viewport
-    float xcamoff = ((RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH)) - vptilesx; // Calculate camera X offset 
-    float ycamoff = ((RESO_X * UP_SHARE) / (VP_WIDTH + UP_SHARE)) - vptilesy; // Calculate camera Y offset 
-
-    // Set thresholds for camera movement
-    int xthreshold = 7;
-    int ythreshold = 4;
+// Pick a random walkable cell
+void bench_random_floor(Uint32* seed, int* x, int* y) {
+    do {
+        *seed = *seed * 1103515245 + 12345;
+        *x = (*seed >> 8) % mapWidth;
+        *seed = *seed * 1103515245 + 12345;
+        *y = (*seed >> 8) % mapHeight;
+    } while (!cell_walkable(*x, *y));
+}
 
-    // Check if player at left or right threshold
-    if (playerX - cameraX <= xthreshold) {
-        cameraX -= (vptilesx / 2); 
-    } else if (playerX - cameraX >= vptilesx - xthreshold) {
-        cameraX += (vptilesx / 2); 
+// Reference path length from a plain breadth-first search (-1 if there is none)
+int bench_bfs_length(int fromX, int fromY, int goalX, int goalY, int* dist, int* queue) {
+    memset(dist, 0xFF, sizeof(int) * mapWidth * mapHeight);
+    int head = 0;
+    int tail = 0;
+    dist[fromY * mapWidth + fromX] = 0;
+    queue[tail++] = fromY * mapWidth + fromX;
+
+    while (head < tail) {
+        int cell = queue[head++];
+        int x = cell % mapWidth;
+        int y = cell / mapWidth;
+        if (x == goalX && y == goalY) return dist[cell];
+        for (int i = 0; i < 4; i++) {
+            int nx = x + distStepX[i];
+            int ny = y + distStepY[i];
+            int neighbour = ny * mapWidth + nx;
+            if (!walk_bit(nx, ny) || dist[neighbour] >= 0) continue;
+            dist[neighbour] = dist[cell] + 1;
+            queue[tail++] = neighbour;
+        }
     }
+    return -1;
+}
 
-    // Check if player at bottom or top threshold
-    if (playerY - cameraY <= ythreshold) {
-        cameraY -= vptilesy / 2;
-    } else if (playerY - cameraY >= vptilesy - ythreshold) {
-        cameraY += vptilesy / 2;
+// Time jump point searches and distance field updates on a generated maze
+int bench_paths(int size, int queries, int corridor) {
+    if (size < 5 || queries < 1 || corridor < 1) {
+        printf("Usage: engine-bench path [maze-size] [queries] [corridor-width]\n");
+        return 1;
+    }
+    if (!bench_generate_maze(size, corridor)) {
+        printf("Unable to generate a %dx%d maze\n", size, size);
+        return 1;
     }
 
-    // Clamp camera position to map boundaries
-    if (cameraX < 0) cameraX = 0;
-    if (cameraY < 0) cameraY = 0;
-    if (cameraX > MAP_WIDTH - vptilesx) cameraX = MAP_WIDTH - vptilesx;
-    if (cameraY > MAP_HEIGHT - vptilesy) cameraY = MAP_HEIGHT - vptilesy;
-
-    // Render visible tiles based on current camera position
-    for (int y = 0; y < MAP_HEIGHT; y++) {
-        for (int x = 0; x < MAP_WIDTH; x++) {
-            int mapX = cameraX + x;
-            int mapY = cameraY + y;
-
-            if (mapX >= 0 && mapX < MAP_WIDTH && mapY >= 0 && mapY < MAP_HEIGHT) {
-                Cell cell = worldMap[mapX][mapY];
-                uint8_t textureIndex = get_texture_index(cell);
-
-                if (textureIndex < NUM_TEX) {
-                    // Calculate texture coordinates in texture atlas
-                    int texCol = textureIndex % ATLAS_COLUMNS;
-                    int texRow = textureIndex / ATLAS_COLUMNS;
-                    SDL_Rect srcRect = { texCol * TILE_SIZE, texRow * TILE_SIZE, TILE_SIZE, TILE_SIZE };
-
-                    // Calculate screen position for tile
-                    SDL_Rect dstRect = { x * tile_size, y * tile_size, tile_size, tile_size };
+    int* dist = malloc(sizeof(int) * size * size);
+    int* queue = malloc(sizeof(int) * size * size);
+    PathStep* path = malloc(sizeof(PathStep) * size * size);
+    Uint64* times = malloc(sizeof(Uint64) * queries);
+    if (!dist || !queue || !path || !times) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    printf("Maze %dx%d, corridors %d wide, %d queries\n", size, size, corridor, queries);
+
+    // Searches between random cells, checked against breadth-first search
+    Uint32 seed = 777;
+    Uint64 bfsTotal = 0;
+    long long steps = 0;
+    int mismatches = 0;
+    for (int q = 0; q < queries; q++) {
+        int sx, sy, gx, gy;
+        bench_random_floor(&seed, &sx, &sy);
+        bench_random_floor(&seed, &gx, &gy);
+
+        Uint64 start = get_time_ns();
+        int length = find_path(sx, sy, gx, gy, path, size * size);
+        times[q] = get_time_ns() - start;
+
+        start = get_time_ns();
+        int expected = bench_bfs_length(sx, sy, gx, gy, dist, queue);
+        bfsTotal += get_time_ns() - start;
+
+        // The path must be connected, walkable and end at the goal
+        int valid = length == expected;
+        for (int i = 0; valid && i < length; i++) {
+            int px = i ? path[i - 1].x : sx;
+            int py = i ? path[i - 1].y : sy;
+            valid = cell_walkable(path[i].x, path[i].y) && abs(path[i].x - px) + abs(path[i].y - py) == 1;
+        }
+        if (valid && length > 0) valid = path[length - 1].x == gx && path[length - 1].y == gy;
+        if (!valid) mismatches++;
+        if (length > 0) steps += length;
+    }
+    Uint64 jpsTotal = 0;
+    for (int q = 0; q < queries; q++) jpsTotal += times[q];
+    qsort(times, queries, sizeof(Uint64), compare_u64);
+    printf("jps      avg %8.3f ms  p99 %8.3f ms  (%.0f steps per path, %d node slots)\n",
+           jpsTotal / 1e6 / queries, times[(queries * 99) / 100] / 1e6, (double)steps / queries, pathSearch.capacity);
+    printf("bfs      avg %8.3f ms\n", bfsTotal / 1e6 / queries);
+
+    // Distance fields: full builds, then repairs after walls are toggled around the targets
+    DistField* reference = malloc(sizeof(DistField));
+    Uint64 computeTotal = 0;
+    Uint64 repairTotal = 0;
+    int repairs = 0;
+    for (int q = 0; q < queries; q++) {
+        int tx, ty;
+        bench_random_floor(&seed, &tx, &ty);
+        Uint64 start = get_time_ns();
+        const DistField* field = acquire_dist_field(tx, ty);
+        computeTotal += get_time_ns() - start;
+
+        for (int i = 0; i < 4; i++) {
+            seed = seed * 1103515245 + 12345;
+            int x = tx + (int)((seed >> 8) % DIST_FIELD_SIZE) - DIST_FIELD_RADIUS;
+            seed = seed * 1103515245 + 12345;
+            int y = ty + (int)((seed >> 8) % DIST_FIELD_SIZE) - DIST_FIELD_RADIUS;
+            if (x <= 0 || y <= 0 || x >= size - 1 || y >= size - 1) continue;
+
+            Cell cell = get_cell(x, y);
+            cell.tileByte = tile_walkable(cell.tileByte) ? (TILE_TYPE_WALL | 1) : 0;
+            start = get_time_ns();
+            set_cell(x, y, cell);
+            repairTotal += get_time_ns() - start;
+            repairs++;
+        }
 
-                    // Blit texture for the tile
-                    SDL_BlitSurface(texture_atlas, &srcRect, surface, &dstRect);
-                } else {
-                    // Render default texture if textureIndex out of bounds
-                    Uint32 defaultColor = SDL_MapRGB(surface->format, 255, 0, 255); // Magenta for errors
-                    SDL_Rect tileRect = { x * tile_size, y * tile_size, tile_size, tile_size };
-                    SDL_FillRect(surface, &tileRect, defaultColor);
-                }
-            }
+        // Every cached field must match a fresh build
+        for (int i = 0; i < MAX_DIST_FIELDS; i++) {
+            if (!distFields[i].valid) continue;
+            compute_dist_field(reference, distFields[i].targetX, distFields[i].targetY);
+            if (memcmp(reference->dist, distFields[i].dist, sizeof(reference->dist)) != 0) mismatches++;
         }
+        (void)field;
     }
+    printf("field    build %6.3f ms  repair %6.3f ms  (%dx%d window)\n",
+           computeTotal / 1e6 / queries, repairs ? repairTotal / 1e6 / repairs : 0.0, DIST_FIELD_SIZE, DIST_FIELD_SIZE);
 
-    // Render player sprite
-    SDL_Rect playerRect = {
-        (int)((playerX - cameraX) * tile_size - tile_size / 2),
-        (int)((playerY - cameraY) * tile_size - tile_size / 2),
-        tile_size,
-        tile_size
-    };
-    SDL_BlitSurface(playerSprite, NULL, surface, &playerRect);
+    if (mismatches) {
+        printf("WARNING: %d paths or distance fields differ from breadth-first search\n", mismatches);
+    } else {
+        printf("Paths and distance fields match breadth-first search\n");
+    }
+
+    free(reference);
+    free(times);
+    free(path);
+    free(queue);
+    free(dist);
+    unload_map();
+    return mismatches != 0;
 }
 
-// Render art mode
-SDL_Surface* artImage = NULL;
-void render_art(SDL_Surface* vpscreen,const char* artfile) {
-    artImage = IMG_Load(artfile);
-    if (!artImage) {
-        printf("Failed to load image: %s\n", IMG_GetError());
-        SDL_Quit();
-        exit(1);
+// Every statement of the event language, run by cells 0x22 (a lever) and 0x23 (a portal)
+const char* benchEventScript =
+    "event 1 2\n"
+    "  if 3 pulled\n"
+    "  set 3\n"
+    "  text The lever clicks.\\nA wall opens.\n"
+    "  tile 5 2 0x00\n"
+    "  mark 4 4 0x23\n"
+    "  clear\n"
+    "  goto done\n"
+    "label pulled\n"
+    "  text Nothing happens.\n"
+    "label done\n"
+    "end\n"
+    "event 1 3\n"
+    "  unless 3 dark\n"
+    "  unset 4\n"
+    "  text Whoosh!\n"
+    "  teleport 10 10\n"
+    "  goto done\n"
+    "label dark\n"
+    "  set 4\n"
+    "  text An empty archway.\n"
+    "label done\n"
+    "end\n";
+
+// Scripts the compiler has to reject, and why
+const char* benchBadEventScripts[][2] = {
+    { "event 1 0\n  text Hello\n", "missing end" },
+    { "event 1 0\n  text Hello\nevent 1 1\nend\n", "missing end" },
+    { "event 1 0\n  goto nowhere\nend\n", "unknown label" },
+    { "event 1 0\n  if 3 nowhere\nlabel here\nend\n", "unknown label" },
+    { "event 1 0\n  set 256\nend\n", "bad flag" },
+    { "event 1 0\n  unset -1\nend\n", "bad flag" },
+};
+
+// Compile a script held in memory
+int bench_compile_events(const char* source, const char* name) {
+    FILE* file = tmpfile();
+    if (!file) {
+        printf("Failed to create a temporary file\n");
+        return 0;
     }
-    SDL_BlitSurface(artImage, NULL, vpscreen, NULL);
+    fputs(source, file);
+    rewind(file);
+    int ok = compile_event_scripts(file, name);
+    fclose(file);
+    return ok;
 }
 
-// Render wide art
-void render_wideart(SDL_Surface* vpscreen, SDL_Surface* coscreen, const char* artfile) {
-    // Calculate viewport and column widths
-    int vpwidt = (RESO_X * VP_WIDTH) / (VP_WIDTH + CO_WIDTH); 
-    int cowidt = RESO_X - vpwidt;
-
-    // Load art image
-    artImage = IMG_Load(artfile);
-    if (!artImage) {
-        printf("Failed to load image: %s\n", IMG_GetError());
-        SDL_Quit();
-        exit(1);
+// Count a failed check
+void bench_event_check(int ok, const char* what, int* failures) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        (*failures)++;
     }
+}
 
-    // Viewport half
-    SDL_Rect srcRectVP = { 0, 0, artImage->w * vpwidt / RESO_X, artImage->h };
-    SDL_Rect dstRectVP = { 0, 0, vpwidt, vpscreen->h };  // Full viewport height
+// Walk onto a cell and let the move finish
+void bench_event_move(void (*move)(Uint32), Uint32* now) {
+    move(*now);
+    *now += MOVE_DURATION;
+    update_movement(*now);
+}
 
-    // Blit to viewport
-    SDL_BlitSurface(artImage, &srcRectVP, vpscreen, &dstRectVP);
+// Check that a flag is set
+int bench_event_flag(int flag) {
+    return (eventFlags[flag >> 3] >> (flag & 7)) & 1;
+}
 
-    // Column half
-    SDL_Rect srcRectCO = { srcRectVP.w, 0, artImage->w * cowidt / RESO_X, artImage->h };
-    SDL_Rect dstRectCO = { 0, 0, cowidt, coscreen->h };  // Full column height
+// Check the message waiting for the dialogue box
+int bench_event_message(const char* text) {
+    return eventMessage && strcmp(eventMessage, text) == 0;
+}
 
-    // Blit to column
-    SDL_BlitSurface(artImage, &srcRectCO, coscreen, &dstRectCO);
+// Event checks: compile scripts, trigger them by walking onto cells, and reject broken scripts
+int bench_events(void) {
+    int failures = 0;
+
+    // The sample scripts of map.bin: its lever opens a wall
+    bench_event_check(load_map("map.bin") && load_map_event_scripts("map.bin"), "map.bin and map.evt load", &failures);
+    bench_event_check(event_at(12, 14) == 0x22 && event_at(20, 12) == 0x23, "map.bin has its lever and archway", &failures);
+    gridX = 11;
+    gridY = 14;
+    gridDir = NORTH;
+    isMoving = 0;
+    isRotating = 0;
+    initiate_move_forward(0);
+    bench_event_check(cell_walkable(16, 15) && event_at(17, 16) == 0x23, "the map.bin lever opens its wall", &failures);
+
+    if (!create_map(16, 16)) {
+        printf("Failed to allocate the event map\n");
+        return 1;
+    }
+    set_cell(5, 2, (Cell){ TILE_TYPE_WALL | 1, 0 });
+    set_cell(3, 2, (Cell){ 0, 0x22 });
+    set_cell(2, 3, (Cell){ 0, 0x23 });
+    bench_event_check(bench_compile_events(benchEventScript, "event check"), "the event script compiles", &failures);
+
+    Uint32 now = 0;
+    gridX = 2;
+    gridY = 2;
+    gridDir = NORTH;
+    playerX = targetX = 2.5;
+    playerY = targetY = 2.5;
+    isMoving = 0;
+    isRotating = 0;
+
+    // The portal stays dark until the lever is pulled
+    bench_event_move(initiate_move_down, &now);
+    bench_event_check(gridX == 2 && gridY == 3, "an unlit portal leaves the party in place", &failures);
+    bench_event_check(bench_event_flag(4), "unless: flag 4 is set", &failures);
+    bench_event_check(bench_event_message("An empty archway."), "unless: the archway message", &failures);
+    bench_event_move(initiate_move_up, &now);
+
+    // Pulling the lever opens the wall, lights a portal and removes the lever
+    bench_event_check(!cell_walkable(5, 2), "the wall blocks before the lever is pulled", &failures);
+    bench_event_move(initiate_move_forward, &now);
+    bench_event_check(gridX == 3 && gridY == 2, "the party steps onto the lever", &failures);
+    bench_event_check(bench_event_flag(3), "set: flag 3 is set", &failures);
+    bench_event_check(bench_event_message("The lever clicks.\nA wall opens."), "text: the lever message", &failures);
+    bench_event_check(get_cell(5, 2).tileByte == 0, "tile: the wall is replaced", &failures);
+    bench_event_check(cell_walkable(5, 2), "tile: the opened cell is walkable", &failures);
+    bench_event_check(event_at(4, 4) == 0x23, "mark: the portal is placed", &failures);
+    bench_event_check(event_at(3, 2) == 0, "clear: the lever is removed", &failures);
+
+    // A lever put back takes the other branch
+    set_cell(3, 2, (Cell){ 0, 0x22 });
+    bench_event_move(initiate_move_backward, &now);
+    bench_event_move(initiate_move_forward, &now);
+    bench_event_check(bench_event_message("Nothing happens."), "if: the pulled lever message", &failures);
+    bench_event_check(event_at(3, 2) == 0x22, "if: the jump skips clear", &failures);
+
+    // The lit portal clears flag 4 and teleports the party
+    bench_event_move(initiate_move_right, &now);
+    bench_event_move(initiate_move_down, &now);
+    initiate_move_down(now);
+    bench_event_check(!bench_event_flag(4), "unset: flag 4 is cleared", &failures);
+    bench_event_check(bench_event_message("Whoosh!"), "text: the portal message", &failures);
+    bench_event_check(gridX == 10 && gridY == 10 && playerX == 10.5 && playerY == 10.5 && !isMoving,
+                      "teleport: the party stands at 10, 10", &failures);
+    unload_map();
+
+    // Text that exactly fills the string table is accepted, one more character is not
+    char* source = malloc(EVENT_STRINGS_MAX * 2);
+    char* p = source + sprintf(source, "event 1 0\n");
+    for (int i = 0; i < EVENT_STRINGS_MAX / 256; i++) {
+        memcpy(p, "text ", 5);
+        memset(p + 5, 'x', 255); // 255 characters and a terminator per message
+        p[260] = '\n';
+        p += 261;
+    }
+    strcpy(p, "end\n");
+    bench_event_check(bench_compile_events(source, "full text"), "text that fills the string table compiles", &failures);
+    strcpy(p, "text x\nend\n");
+    bench_event_check(!bench_compile_events(source, "too much text") && eventScriptError &&
+                      strcmp(eventScriptError, "too much text") == 0, "too much text is rejected", &failures);
+    free(source);
+
+    for (int i = 0; i < (int)(sizeof(benchBadEventScripts) / sizeof(benchBadEventScripts[0])); i++) {
+        const char* expected = benchBadEventScripts[i][1];
+        int ok = !bench_compile_events(benchBadEventScripts[i][0], "bad script") && eventScriptError &&
+                 strcmp(eventScriptError, expected) == 0 && eventScripts[1][0] < 0;
+        bench_event_check(ok, expected, &failures);
+    }
+
+    if (failures) {
+        printf("WARNING: %d event checks failed\n", failures);
+    } else {
+        printf("Event scripts behave as expected\n");
+    }
+    return failures != 0;
 }
 
+// Headless benchmark: render scripted camera paths into an offscreen surface
 int main(int argc, char* argv[]) {
-    // Initialize SDL
+    if (argc > 1 && strcmp(argv[1], "path") == 0) {
+        return bench_paths(argc > 2 ? atoi(argv[2]) : BENCH_MAZE_SIZE, argc > 3 ? atoi(argv[3]) : BENCH_PATH_QUERIES,
+                           argc > 4 ? atoi(argv[4]) : BENCH_MAZE_CORRIDOR);
+    }
+    if (argc > 1 && strcmp(argv[1], "events") == 0) return bench_events();
+
+    // golden [channel-tolerance] [pixel-tolerance] [diff-dir]: check renderers against their references
+    int goldenMode = argc > 1 && strcmp(argv[1], "golden") == 0;
+    if (goldenMode) {
+        golden.channelTolerance = argc > 2 ? atoi(argv[2]) : 0;
+        golden.pixelTolerance = argc > 3 ? atoi(argv[3]) : 0;
+        golden.diffDir = argc > 4 ? argv[4] : NULL;
+    }
+
+    int frames = BENCH_FRAMES;
+    if (!goldenMode) {
+        if (argc > 1) frames = atoi(argv[1]);
+        if (argc > 2) renderThreads = atoi(argv[2]);
+        if (argc > 3) renderBandWidth = atoi(argv[3]);
+        if (argc > 4) raySimd = atoi(argv[4]);
+        if (argc > 5) rayFixed = atoi(argv[5]);
+        if (argc > 6) directCompositing = atoi(argv[6]);
+        if (argc > 7) textureMipmaps = atoi(argv[7]);
+    }
+    if (frames < 1) {
+        printf("Usage: %s [frames-per-path] [threads] [band-width] [simd] [fixed] [direct] [mipmaps]\n", argv[0]);
+        printf("       %s path [maze-size] [queries] [corridor-width]\n", argv[0]);
+        printf("       %s golden [channel-tolerance] [pixel-tolerance] [diff-dir]\n", argv[0]);
+        printf("       %s events\n", argv[0]);
+        return 1;
+    }
+
+    // No window: render through the dummy video driver
+    SDL_putenv("SDL_VIDEODRIVER=dummy");
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("Unable to initialize SDL: %s\n", SDL_GetError());
         return 1;
     }
 
-
-    Uint32 lastTime = SDL_GetTicks();
-
-    // Create a window
     SDL_Surface* screen = SDL_SetVideoMode(RESO_X, RESO_Y, 32, SDL_SWSURFACE);
     if (!screen) {
         printf("Unable to set video mode: %s\n", SDL_GetError());
@@ -921,150 +5657,112 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Load the PNG font image
-    SDL_Surface* font_surface = IMG_Load("font.png");
-    if (!font_surface) {
-        printf("Unable to load font: %s\n", IMG_GetError());
-        SDL_Quit();
-        return 1;
-    }
-
-    // Load the PNG Texture Atlas 
-    load_texture_atlas("atlas.png");
-
-    // Load the PNG Character Sprite
-    load_player_sprite("pc.png");
-
-    // Set the window title
-    SDL_WM_SetCaption("Goldbox Game Engine Clone (InDev)", NULL);
-
-    // Calculate layout proportions
     int viewport_width, column_width, viewport_height, column_height, dialogue_height;
     calculate_layout(&viewport_width, &column_width, &viewport_height, &column_height, &dialogue_height);
 
-    // Create viewport surface
-    SDL_Surface* viewport_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, viewport_width, viewport_height, 32, 0, 0, 0, 0);
+    // The viewport is a view of the screen, as in main(), or a surface blitted to it
+    SDL_Rect viewport_rect = {0, 0, viewport_width, viewport_height};
+    SDL_Surface* viewport_surface = directCompositing ? create_screen_view(screen, viewport_rect)
+                                                      : SDL_CreateRGBSurface(SDL_SWSURFACE, viewport_width, viewport_height, 32, 0, 0, 0, 0);
     if (!viewport_surface) {
         printf("Unable to create viewport surface: %s\n", SDL_GetError());
         SDL_Quit();
         return 1;
     }
 
-    // Initialize the world map
     initialize_worldMap("map.bin", "atlas.png");
+    build_light_tables();
 
-    // Create surfaces for each text quadrant
-    SDL_Surface* column_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, column_width, column_height, 32, 0, 0, 0, 0);
-    SDL_Surface* dialogue_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, RESO_X, dialogue_height, 32, 0, 0, 0, 0);
-
-    // Set initial display mode
-    currentDisplayMode = DISPLAY_MODE_RAYCASTER;
-
-    // Event loop
-    int running = 1;
-    SDL_Event event;
-    Uint32 frameStart, frameTime; // Track frame time
-
-    
-    while (running) {
-        frameStart = SDL_GetTicks(); // Start time of the frame
+    if (goldenMode) {
+        int passed = golden_check(screen, viewport_width, viewport_height);
+        free_screen_views();
+        if (!directCompositing) SDL_FreeSurface(viewport_surface);
+        render_pool_stop();
+        SDL_Quit();
+        return passed ? 0 : 1;
+    }
 
-        // Event handling
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                running = 0;
-            } else if (event.type == SDL_KEYDOWN) {
-                // Global input handling
-                if (event.key.keysym.sym == SDLK_ESCAPE) {
-                    running = 0;
-                } else if (event.key.keysym.sym == SDLK_TAB) {
-                    if (currentDisplayMode == DISPLAY_MODE_RAYCASTER) {
-                        currentDisplayMode = DISPLAY_MODE_TOPDOWN;
-                    } else if (currentDisplayMode == DISPLAY_MODE_TOPDOWN) {
-                        currentDisplayMode = DISPLAY_MODE_ART;
-                    } else if (currentDisplayMode == DISPLAY_MODE_ART) {
-                        currentDisplayMode = DISPLAY_MODE_WIDE_ART;
-                    } else {
-                        currentDisplayMode = DISPLAY_MODE_RAYCASTER;
-                    }
-                } else {
-                    // Handle input based on display mode
-                    switch (currentDisplayMode) {
-                        case DISPLAY_MODE_RAYCASTER:
-                            handle_raycasting_input(event);
-                            break;
-                        case DISPLAY_MODE_TOPDOWN:
-                            handle_top_down_input(event);
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            }
-        }
+    Uint64* frameTimes = malloc(sizeof(Uint64) * frames * NUM_BENCH_PATHS);
+    if (!frameTimes) {
+        printf("Unable to allocate frame times for %d frames\n", frames);
+        free_screen_views();
+        if (!directCompositing) SDL_FreeSurface(viewport_surface);
+        SDL_Quit();
+        return 1;
+    }
+    Uint64 allPhases[NUM_PHASES] = {0};
 
-        // Update animations
-        Uint32 currentTime = SDL_GetTicks();
-        update_movement(currentTime);
-        update_rotation(currentTime);
-        
-        // Clear the viewport surface
-        SDL_FillRect(viewport_surface, NULL, SDL_MapRGB(viewport_surface->format, 0, 0, 0));
+    select_ray_caster();
+    printf("Viewport %dx%d, %d frames per path, %d render threads, %d column bands, %s rays, %s compositing, %s\n",
+           viewport_width, viewport_height, frames, render_thread_count(), renderBandWidth, rayCasterName,
+           directCompositing ? "direct" : "blit", textureMipmaps ? "mipmaps" : "no mipmaps");
 
-    // Rendering based on display mode
-    switch (currentDisplayMode) {
-        case DISPLAY_MODE_RAYCASTER:
-            raycaster(viewport_surface, viewport_width, viewport_height);
-            break;
-        case DISPLAY_MODE_TOPDOWN:
-            render_top_down(viewport_surface, TILE_SIZE);
-            break;
-        case DISPLAY_MODE_ART:
-            render_art(viewport_surface, "test.png");
-            break;
-        case DISPLAY_MODE_WIDE_ART:
-            render_wideart(viewport_surface, column_surface, "widetest.png");
-            break;
-        default:
-            break;
+    // Banded and packet rendering must match the single-threaded scalar path exactly
+    if (render_thread_count() > 1 || cast_packet != cast_packet_scalar) {
+        bench_check_equivalence(viewport_surface, viewport_width, viewport_height);
     }
 
-        // Clear the quadrants (you can fill them or print something to them)
-        SDL_FillRect(dialogue_surface, NULL, SDL_MapRGB(screen->format, 200, 80, 30));
+    for (int p = 0; p < NUM_BENCH_PATHS; p++) {
+        const BenchPath* path = &benchPaths[p];
+        Uint64* times = frameTimes + p * frames;
+        bench_spawn_sprites(path->numSprites);
 
-        // Render text to the column surface
-        if (currentDisplayMode != DISPLAY_MODE_WIDE_ART) {
-        SDL_FillRect(column_surface, NULL, SDL_MapRGB(screen->format, 180, 70, 26));
-        draw_text(column_surface, font_surface, 10, 10, "This is the \ninfo column.\nCharacter info\nor stats could\ngo here!");
+        // Warm caches before timing
+        for (int i = 0; i < BENCH_WARMUP; i++) {
+            bench_set_camera(path, 0.0);
+            raycaster(viewport_surface, viewport_width, viewport_height);
         }
+        memset(phaseTime, 0, sizeof(phaseTime));
+#ifdef OVERDRAW
+        Uint64 pathUnwritten = 0, pathOverdrawn = 0, pathWrites = 0;
+#endif
 
-        // Render text to the dialogue box
-        draw_text(dialogue_surface, font_surface, 10, 10, "This is the dialogue box, which explains what]s\ngoing on, and conveys story info.");
-
-        // Blit each surface onto the main screen
-        SDL_Rect viewport_rect = {0, 0, viewport_width, viewport_height};
-        SDL_Rect column_rect = {viewport_width, 0, column_width, column_height};
-        SDL_Rect dialogue_rect = {0, viewport_height, RESO_X, dialogue_height};
+        for (int i = 0; i < frames; i++) {
+            bench_set_camera(path, frames > 1 ? (double)i / (frames - 1) : 0.0);
 
-        SDL_BlitSurface(viewport_surface, NULL, screen, &viewport_rect);
-        SDL_BlitSurface(column_surface, NULL, screen, &column_rect);
-        SDL_BlitSurface(dialogue_surface, NULL, screen, &dialogue_rect);
+            Uint64 frameStart = get_time_ns();
 
-        // Update the screen
-        SDL_Flip(screen);
+            // Same work as one raycaster frame in main()
+            if (directCompositing) lock_screen_views(screen);
+            raycaster(viewport_surface, viewport_width, viewport_height);
 
-        // Frame rate control
-        frameTime = SDL_GetTicks() - frameStart;
-        if (frameTime < FRAME_DELAY) {
-            SDL_Delay(FRAME_DELAY - frameTime);
+            PHASE_START(phaseClock);
+            if (directCompositing) {
+                unlock_screen_views(screen);
+            } else {
+                SDL_BlitSurface(viewport_surface, NULL, screen, &viewport_rect);
+            }
+            PHASE_MARK(phaseClock, PHASE_BLIT);
+            PHASE_FLUSH();
+
+            times[i] = get_time_ns() - frameStart;
+#ifdef OVERDRAW
+            int unwritten, overdrawn;
+            Uint64 writes;
+            overdraw_summary(&unwritten, &overdrawn, &writes);
+            pathUnwritten += unwritten;
+            pathOverdrawn += overdrawn;
+            pathWrites += writes;
+#endif
         }
+
+        for (int ph = 0; ph < NUM_PHASES; ph++) allPhases[ph] += phaseTime[ph];
+        bench_report(path->name, times, frames, phaseTime);
+#ifdef OVERDRAW
+        double pixels = (double)viewport_width * viewport_height * frames;
+        printf("          overdraw: %.3f writes per pixel, %.2f%% of pixels written more than once, %.0f never written per frame\n",
+               pathWrites / pixels, 100.0 * pathOverdrawn / pixels, (double)pathUnwritten / frames);
+#endif
     }
 
-    SDL_FreeSurface(viewport_surface);
-    SDL_FreeSurface(column_surface);
-    SDL_FreeSurface(dialogue_surface);
-    SDL_FreeSurface(font_surface);
+    bench_report("total", frameTimes, frames * NUM_BENCH_PATHS, allPhases);
+
+    free(frameTimes);
+    free_screen_views();
+    if (!directCompositing) SDL_FreeSurface(viewport_surface);
+    render_pool_stop();
     SDL_Quit();
 
     return 0;
 }
+#endif